@@ -0,0 +1,21 @@
+#!/bin/sh
+# Run the simulator over a generated workload suite and print the run
+# summary of every input under each balance mode and quantum. SEED, SCALE,
+# MODES, QUANTA and SIM_FLAGS can be overridden from the environment, e.g.
+# MODES=hybrid QUANTA="1 adaptive" SIM_FLAGS="-p affinity" ./bench.sh
+SEED=${SEED:-307}
+SCALE=${SCALE:-50}
+MODES=${MODES:-"pull push hybrid"}
+QUANTA=${QUANTA:-1}
+SUITE="uniform zipf bimodal onecore bursty dag inject"
+
+mkdir -p bench
+for dist in $SUITE; do
+    ./generator -d $dist -s $SEED -o bench/$dist.txt > /dev/null || exit 1
+    for mode in $MODES; do
+        for quantum in $QUANTA; do
+            echo "== $dist -b $mode -k $quantum $SIM_FLAGS"
+            ./sim -l 0 -S -x $SCALE -b $mode -k $quantum $SIM_FLAGS bench/$dist.txt | sed -n '/^Makespan/,$p'
+        done
+    done
+done
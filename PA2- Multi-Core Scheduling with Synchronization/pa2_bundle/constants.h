@@ -5,5 +5,8 @@
 #define CYCLE 200
 #define CACHE_FACTOR 0.05
 #define MAX_CACHE_FACTOR 4.0
+// Cache factor of a task stolen across sockets, below cold since its data
+// has to come over the socket interconnect first
+#define REMOTE_CACHE_FACTOR 0.75
 
 #endif
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "constants.h"
+#include "sim_config.h"
+#include "real_work.h"
+
+#define LINE_SIZE 64
+
+// One cache line of the working set, next links all lines in random order
+typedef struct WorkLine {
+    size_t next;
+    uint64_t payload[LINE_SIZE / sizeof(uint64_t) - 1];
+} WorkLine;
+
+// Slices measured by one core, only written by that core
+typedef struct SliceStats {
+    long slices;
+    long us;
+    long misses;
+    double model_factor;    // Sum of cache_warmed_up at the start of the slices
+} SliceStats;
+
+static SliceStats cold_stats[NUM_CORES];
+static SliceStats warm_stats[NUM_CORES];
+static int perf_open[NUM_CORES];    // Core opened its miss counter, only written by that core
+static __thread int perf_fd = -2;   // -2 until the core thread tried to open it
+static __thread unsigned int shuffle_seed;  // rand_r state of the core thread
+static volatile uint64_t sink;
+
+static int open_miss_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Count this thread on whatever CPU it runs
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long read_counter() {
+    uint64_t value = 0;
+    if (perf_fd < 0 || read(perf_fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return (long) value;
+}
+
+static WorkLine* alloc_working_set(size_t lines) {
+    WorkLine* set = aligned_alloc(LINE_SIZE, lines * sizeof(WorkLine));
+    if (set == NULL) {
+        perror("real_work");
+        exit(EXIT_FAILURE);
+    }
+
+    // Random cyclic permutation so the prefetcher can't hide the misses
+    size_t* order = malloc(lines * sizeof(size_t));
+    for (size_t i = 0; i < lines; i++) order[i] = i;
+    for (size_t i = lines - 1; i > 0; i--) {
+        size_t j = rand_r(&shuffle_seed) % (i + 1);
+        size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (size_t i = 0; i < lines; i++) {
+        set[order[i]].next = order[(i + 1) % lines];
+        memset(set[order[i]].payload, 0, sizeof(set[order[i]].payload));
+    }
+    free(order);
+    return set;
+}
+
+long real_work_run(int my_id, Task* task) {
+    size_t lines = (size_t) sim_config.work_kb * 1024 / LINE_SIZE;
+    if (lines == 0) return 0;
+    if (perf_fd == -2) {
+        perf_fd = open_miss_counter();
+        perf_open[my_id] = perf_fd >= 0;
+        // Cores shuffle independently, rand() would serialize them on its lock
+        shuffle_seed = my_id + 1;
+    }
+
+    // The slice right after allocation finds the freshly written buffer in
+    // cache, it is run but left out of the statistics
+    int first_touch = task -> working_set == NULL;
+    if (first_touch) task -> working_set = alloc_working_set(lines);
+
+    SliceStats* stats = task -> cache_warmed_up > 1.0 ? &warm_stats[my_id] : &cold_stats[my_id];
+    struct timespec start, end;
+    long misses_before = read_counter();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Read and dirty every line once
+    WorkLine* set = task -> working_set;
+    size_t line = 0;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < lines; i++) {
+        sum += set[line].payload[0]++;
+        line = set[line].next;
+    }
+    sink = sum;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long misses_after = read_counter();
+    long us = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+
+    if (first_touch) return us;
+    stats -> slices++;
+    stats -> us += us;
+    stats -> model_factor += task -> cache_warmed_up;
+    if (misses_before >= 0 && misses_after >= 0) stats -> misses += misses_after - misses_before;
+    return us;
+}
+
+void real_work_release(Task* task) {
+    free(task -> working_set);
+    task -> working_set = NULL;
+}
+
+void real_work_print() {
+    SliceStats cold = { 0 }, warm = { 0 };
+    long cold_counted = 0, warm_counted = 0;    // Slices of cores with a miss counter
+    int perf_cores = 0;
+    for (int i = 0; i < NUM_CORES; i++) {
+        cold.slices += cold_stats[i].slices;
+        cold.us += cold_stats[i].us;
+        cold.model_factor += cold_stats[i].model_factor;
+        warm.slices += warm_stats[i].slices;
+        warm.us += warm_stats[i].us;
+        warm.model_factor += warm_stats[i].model_factor;
+        if (perf_open[i]) {
+            perf_cores++;
+            cold.misses += cold_stats[i].misses;
+            cold_counted += cold_stats[i].slices;
+            warm.misses += warm_stats[i].misses;
+            warm_counted += warm_stats[i].slices;
+        }
+    }
+    double cold_us = cold.slices > 0 ? (double) cold.us / cold.slices : 0;
+    double warm_us = warm.slices > 0 ? (double) warm.us / warm.slices : 0;
+    double model_speedup = warm.slices > 0 ? warm.model_factor / warm.slices : 1.0;
+
+    printf("Real work: %d KB working set per task\n", sim_config.work_kb);
+    printf("  cold slices: %ld, %.1f us average", cold.slices, cold_us);
+    if (perf_cores > 0) printf(", %.0f cache misses average", cold_counted > 0 ? (double) cold.misses / cold_counted : 0.0);
+    printf("\n  warm slices: %ld, %.1f us average", warm.slices, warm_us);
+    if (perf_cores > 0) printf(", %.0f cache misses average", warm_counted > 0 ? (double) warm.misses / warm_counted : 0.0);
+    printf("\n  measured warm speedup %.2f, model speedup %.2f\n",
+           warm_us > 0 ? cold_us / warm_us : 0.0, model_speedup);
+    if (perf_cores == 0) {
+        printf("  cache misses unavailable, perf_event_open not permitted\n");
+    } else if (perf_cores < NUM_CORES) {
+        printf("  cache misses from the %d cores that opened a counter\n", perf_cores);
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef REAL_WORK_H
+#define REAL_WORK_H
+
+#include "wbq.h"
+
+// Real work execution mode. Every task owns a working set buffer and each
+// simulated cycle chases pointers through all of its cache lines. The wall
+// clock time and, where perf_event_open is allowed, the cache misses of
+// every slice are recorded, split by whether the cache model considers the
+// task cold (cache_warmed_up of 1.0) or warm, so the CACHE_FACTOR and
+// MAX_CACHE_FACTOR model can be checked against the hardware.
+
+// Run one cycle of the kernel over the working set of task on core my_id,
+// allocating the working set on first use. Returns the wall clock time in us.
+long real_work_run(int my_id, Task* task);
+
+// Release the working set of a finished task.
+void real_work_release(Task* task);
+
+void real_work_print();
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SIM_CONFIG_H
+#define SIM_CONFIG_H
+
+#include "sim_log.h"
+
+typedef enum StealPolicyType {
+    STEAL_TAIL,             // Take the victim's tail, the baseline
+    STEAL_AFFINITY,         // Pick the task with the best cache affinity cost
+    STEAL_CRITICAL          // Pick the task with the longest critical path
+} StealPolicyType;
+
+typedef enum BalanceMode {
+    BALANCE_PULL,           // Idle cores steal, the default
+    BALANCE_PUSH,           // Overloaded cores hand tasks to the least loaded core
+    BALANCE_HYBRID          // Both of the above
+} BalanceMode;
+
+typedef enum GangMode {
+    GANG_OFF,               // No task groups
+    GANG_MODEL,             // Shared cache bonus for co-running group members only
+    GANG_SCHEDULE           // Bonus plus co-scheduling of groups in time windows
+} GangMode;
+
+typedef enum QueueDiscipline {
+    QUEUE_RR,               // Unfinished tasks go back to the tail, the default
+    QUEUE_MLFQ              // Multilevel feedback queue with demotion and boost
+} QueueDiscipline;
+
+// Run time options of the simulator, filled in by main from the command
+// line before any simulator thread starts and read-only afterwards.
+typedef struct SimConfig {
+    SimLogLevel log_level;  // -l, see sim_log.h
+    double time_scale;      // -x, simulated milliseconds per wall clock millisecond
+    int print_stats;        // -S, print the run summary at exit
+    StealPolicyType steal_policy;   // -p, tail or affinity
+    BalanceMode balance_mode;       // -b, pull, push or hybrid
+    QueueDiscipline queue_discipline;   // -q, rr or mlfq
+    GangMode gang_mode;             // -g, off, model or gang
+    int elastic;                    // -e, park cores while there is little work
+    int quantum_cycles;             // -k, cycles per dispatch, 0 is the adaptive quantum
+    int work_kb;                    // -w, working set per task in real work mode, 0 is off
+    const char* trace_file;         // -r, binary scheduling trace output, NULL is off
+    const char* topology_file;      // -T, topology description file or "sys", NULL steals in index order
+} SimConfig;
+
+extern SimConfig sim_config;
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "constants.h"
+#include "sim_log.h"
+
+#define LOG_RING_SIZE 4096      // Events per core, must be a power of two
+#define LOG_CACHE_LINE 64
+
+typedef enum LogEventType {
+    LOG_EXECUTED,
+    LOG_FINISHED
+} LogEventType;
+
+// Binary record of one simulated cycle. The task id points at the string
+// interned by the task loader, which lives until free_tasks() and so outlasts
+// the final drain in sim_log_shutdown().
+typedef struct LogEvent {
+    int type;
+    int core;
+    int remaining;
+    const char* task_id;
+} LogEvent;
+
+// Single-producer single-consumer ring. head is only written by the core,
+// tail only by the writer thread, each on its own cache line.
+typedef struct LogRing {
+    _Alignas(LOG_CACHE_LINE) atomic_size_t head;
+    _Alignas(LOG_CACHE_LINE) atomic_size_t tail;
+    _Alignas(LOG_CACHE_LINE) LogEvent events[LOG_RING_SIZE];
+} LogRing;
+
+static LogRing* rings;
+static SimLogLevel log_level = SIM_LOG_ALL;
+static atomic_int writer_running;
+static pthread_t writer_thread;
+
+// Format and write every pending event of one ring, returns the number written.
+static size_t drain_ring(LogRing* ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t written = 0;
+
+    while (tail != head) {
+        LogEvent* e = &ring->events[tail & (LOG_RING_SIZE - 1)];
+        if (e->type == LOG_FINISHED) {
+            printf("Processor %d: Finished task %s\n", e->core, e->task_id);
+        } else {
+            printf("Processor %d: Executed task %s, it has %d ms remaining\n", e->core, e->task_id, e->remaining);
+        }
+        tail++;
+        written++;
+    }
+
+    // Publish the free slots only after the lines reached stdout
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    return written;
+}
+
+static void* writer_loop(void* arg) {
+    (void) arg;
+    while (atomic_load(&writer_running)) {
+        size_t written = 0;
+        for (int i = 0; i < NUM_CORES; i++) {
+            written += drain_ring(&rings[i]);
+        }
+        if (written == 0) {
+            fflush(stdout);
+            usleep(1000);
+        }
+    }
+
+    // Final drain after the cores stopped producing
+    for (int i = 0; i < NUM_CORES; i++) {
+        drain_ring(&rings[i]);
+    }
+    fflush(stdout);
+    return NULL;
+}
+
+static void record(int type, int my_id, const Task* task) {
+    LogRing* ring = &rings[my_id];
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    // Wait for the writer instead of dropping lines when the ring is full
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SIZE) {
+        sched_yield();
+    }
+
+    LogEvent* e = &ring->events[head & (LOG_RING_SIZE - 1)];
+    e->type = type;
+    e->core = my_id;
+    e->remaining = task -> task_duration;
+    e->task_id = task -> task_id;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void sim_log_init(SimLogLevel level) {
+    log_level = level;
+    if (log_level == SIM_LOG_OFF) return;
+
+    rings = aligned_alloc(LOG_CACHE_LINE, NUM_CORES * sizeof(LogRing));
+    if (rings == NULL) {
+        perror("sim_log_init");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < NUM_CORES; i++) {
+        atomic_init(&rings[i].head, 0);
+        atomic_init(&rings[i].tail, 0);
+    }
+
+    atomic_store(&writer_running, 1);
+    if (pthread_create(&writer_thread, NULL, &writer_loop, NULL)) {
+        perror("sim_log_init");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void sim_log_executed(int my_id, const Task* task) {
+    if (log_level < SIM_LOG_ALL) return;
+    record(LOG_EXECUTED, my_id, task);
+}
+
+void sim_log_finished(int my_id, const Task* task) {
+    if (log_level < SIM_LOG_FINISHED) return;
+    record(LOG_FINISHED, my_id, task);
+}
+
+void sim_log_flush() {
+    if (log_level == SIM_LOG_OFF) return;
+
+    for (int i = 0; i < NUM_CORES; i++) {
+        LogRing* ring = &rings[i];
+        while (atomic_load_explicit(&ring->tail, memory_order_acquire) !=
+               atomic_load_explicit(&ring->head, memory_order_acquire)) {
+            usleep(100);
+        }
+    }
+    fflush(stdout);
+}
+
+void sim_log_shutdown() {
+    if (log_level == SIM_LOG_OFF) return;
+
+    atomic_store(&writer_running, 0);
+    pthread_join(writer_thread, NULL);
+    free(rings);
+    rings = NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef SIM_LOG_H
+#define SIM_LOG_H
+
+#include "wbq.h"
+
+// Buffered execution log for the simulator threads.
+// Each core owns a single-producer ring of binary events. A single writer
+// thread drains the rings and formats them in the same text format as the
+// sample outputs, so cores never touch the shared stdout FILE themselves.
+
+typedef enum SimLogLevel {
+    SIM_LOG_OFF = 0,        // Drop every event, meant for benchmarks
+    SIM_LOG_FINISHED = 1,   // Only log finished tasks
+    SIM_LOG_ALL = 2         // Log every executed cycle (default)
+} SimLogLevel;
+
+// Start the writer thread, must be called before the core threads start.
+void sim_log_init(SimLogLevel level);
+
+// Record events from core my_id, only the owning core may call these.
+void sim_log_executed(int my_id, const Task* task);
+void sim_log_finished(int my_id, const Task* task);
+
+// Block until every event recorded so far has been written to stdout.
+void sim_log_flush();
+
+// Drain the remaining events and join the writer thread.
+void sim_log_shutdown();
+
+#endif
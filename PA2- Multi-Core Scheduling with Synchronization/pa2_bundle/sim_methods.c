@@ -7,6 +7,13 @@
 #include <time.h>
 #include "wbq.h"
 #include "constants.h"
+#include "sim_log.h"
+#include "sim_config.h"
+#include "sim_stats.h"
+#include "task_loader.h"
+#include "real_work.h"
+#include "topology.h"
+#include "sim_trace.h"
 
 // This is a sample file we will use to call your API and test.
 // executeJob is the function you will call to simulate task execution
@@ -18,6 +25,22 @@
 int stop_threads = 0;
 int finished_jobs[NUM_CORES];
 WorkBalancerQueue** processor_queues;
+InjectionQueue injection_queue;
+int num_groups;
+SimConfig sim_config = {
+    .log_level = SIM_LOG_ALL,
+    .time_scale = 1.0,
+    .print_stats = 0,
+    .steal_policy = STEAL_TAIL,
+    .balance_mode = BALANCE_PULL,
+    .queue_discipline = QUEUE_RR,
+    .gang_mode = GANG_OFF,
+    .elastic = 0,
+    .quantum_cycles = 1,
+    .work_kb = 0,
+    .trace_file = NULL,
+    .topology_file = NULL,
+};
 
 // Simulate task execution
 void executeJob(Task* task, WorkBalancerQueue* my_queue, int my_id ) {
@@ -27,22 +50,62 @@ void executeJob(Task* task, WorkBalancerQueue* my_queue, int my_id ) {
         task -> owner = my_queue;
         task -> cache_warmed_up = 1.0;
     } 
+    sim_trace(my_id, TRACE_SLICE_START, task, -1, 0);
+
+    // In real work mode the cycle also runs the memory kernel over the
+    // task's working set, before the cache factor is updated
+    long work_us = 0;
+    if (sim_config.work_kb > 0) work_us = real_work_run(my_id, task);
 
     // If the next execution finishes the task, set its remaining time to 0
     // Notify the main thread that a job was finished by updating finished_jobs.
     // Else, update cache factor and duration accordingly.
+    sim_stats.busy_cycles[my_id]++;
     if (task -> task_duration - (CYCLE * task -> cache_warmed_up) <= 0) {
         task -> task_duration = 0;
-        printf("Processor %d: Finished task %s\n", my_id, task -> task_id);
+        sim_log_finished(my_id, task);
         finished_jobs[my_id]++;
     } else {
         task -> task_duration -= CYCLE * task -> cache_warmed_up;
-        printf("Processor %d: Executed task %s for %.2f ms\n", my_id, task -> task_id, CYCLE * task -> cache_warmed_up);
+        sim_log_executed(my_id, task);
         if (task -> cache_warmed_up < MAX_CACHE_FACTOR ) task -> cache_warmed_up += CACHE_FACTOR;
     }
 
-    // Sleep for one simulate CPU cycle
-    usleep(CYCLE * 1000);
+    // Sleep for the rest of one simulate CPU cycle, shortened by the time scale
+    long cycle_us = CYCLE * 1000 / sim_config.time_scale;
+    if (work_us < cycle_us) usleep(cycle_us - work_us);
+    sim_trace(my_id, TRACE_SLICE_END, task, -1, task -> task_duration);
+    if (task -> task_duration == 0) {
+        if (sim_config.work_kb > 0) real_work_release(task);
+        task -> finish_ms = sim_time_ms();
+        sim_stats.last_finish_ms[my_id] = task -> finish_ms;
+    }
+}
+
+// Hand a loaded task to the queue of its core. Tasks with unfinished
+// predecessors are submitted by the core finishing the last of them.
+void release_task(TaskRelease* release) {
+    if (atomic_fetch_sub(&release -> task -> pending_preds, 1) != 1) return;
+
+    // Tasks for any core go to the injection queue, the first idle core takes them
+    int core = release -> core;
+    if (core == RELEASE_ANY_CORE) {
+        if (injectTask(&injection_queue, release -> task) == 0) return;
+
+        // Injection queue is full, fall back to the least loaded core
+        int least_work = INT_MAX;
+        for (int i = 0; i < NUM_CORES; i++) {
+            pthread_mutex_lock(&processor_queues[i] -> mutex);
+            int work = processor_queues[i] -> work;
+            pthread_mutex_unlock(&processor_queues[i] -> mutex);
+            if (work < least_work) {
+                least_work = work;
+                core = i;
+            }
+        }
+    }
+    release -> task -> owner = processor_queues[core];
+    submitTask(processor_queues[core], release -> task);
 }
 
 // Check if sufficient number of jobs were finished.
@@ -54,24 +117,149 @@ int all_jobs_finished(int registered_jobs) {
     return sum >= registered_jobs;
 }
 
+void usage(const char* prog) {
+    fprintf(stderr, "Incorrect call, usage: %s [options] <filename>\n", prog);
+    fprintf(stderr, "  -l <level>   log level: 0 off, 1 finished tasks only, 2 everything (default)\n");
+    fprintf(stderr, "  -x <scale>   run the simulated clock scale times faster than real time\n");
+    fprintf(stderr, "  -S           print makespan, load imbalance and steal statistics at exit\n");
+    fprintf(stderr, "  -p <policy>  steal policy: tail (default), affinity or critical\n");
+    fprintf(stderr, "  -b <mode>    load balancing: pull (default), push or hybrid\n");
+    fprintf(stderr, "  -q <queue>   per core queue: rr (default) or mlfq\n");
+    fprintf(stderr, "  -g <gang>    task groups: off (default), model for the shared cache bonus only, or gang\n");
+    fprintf(stderr, "  -e           elastic mode, park cores while there is little work\n");
+    fprintf(stderr, "  -k <cycles>  cycles a task runs per dispatch (default 1), or adaptive\n");
+    fprintf(stderr, "  -w <kb>      real work mode, every task runs a memory kernel over kb of data\n");
+    fprintf(stderr, "  -r <file>    record a binary scheduling trace, view it with trace_tool\n");
+    fprintf(stderr, "  -T <file>    pin cores and steal nearest first, topology file or sys for sysfs\n");
+}
+
 int main(int argc, char* argv[]) {
     // Parse command line arguments
-    if (argc != 2) {
-        fprintf(stderr, "Incorrect call, usage: %s <filename>\n", argv[0]);
+    int opt;
+    while ((opt = getopt(argc, argv, "l:x:Sp:b:q:w:T:r:k:eg:")) != -1) {
+        switch (opt) {
+        case 'l': {
+            char* end;
+            long level = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || level < SIM_LOG_OFF || level > SIM_LOG_ALL) {
+                fprintf(stderr, "Invalid log level %s\n", optarg);
+                return 1;
+            }
+            sim_config.log_level = (SimLogLevel) level;
+            break;
+        }
+        case 'x':
+            sim_config.time_scale = atof(optarg);
+            if (sim_config.time_scale <= 0) {
+                fprintf(stderr, "Invalid time scale %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'S':
+            sim_config.print_stats = 1;
+            break;
+        case 'p':
+            if (strcmp(optarg, "tail") == 0) {
+                sim_config.steal_policy = STEAL_TAIL;
+            } else if (strcmp(optarg, "affinity") == 0) {
+                sim_config.steal_policy = STEAL_AFFINITY;
+            } else if (strcmp(optarg, "critical") == 0) {
+                sim_config.steal_policy = STEAL_CRITICAL;
+            } else {
+                fprintf(stderr, "Invalid steal policy %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'b':
+            if (strcmp(optarg, "pull") == 0) {
+                sim_config.balance_mode = BALANCE_PULL;
+            } else if (strcmp(optarg, "push") == 0) {
+                sim_config.balance_mode = BALANCE_PUSH;
+            } else if (strcmp(optarg, "hybrid") == 0) {
+                sim_config.balance_mode = BALANCE_HYBRID;
+            } else {
+                fprintf(stderr, "Invalid balance mode %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'g':
+            if (strcmp(optarg, "off") == 0) {
+                sim_config.gang_mode = GANG_OFF;
+            } else if (strcmp(optarg, "model") == 0) {
+                sim_config.gang_mode = GANG_MODEL;
+            } else if (strcmp(optarg, "gang") == 0) {
+                sim_config.gang_mode = GANG_SCHEDULE;
+            } else {
+                fprintf(stderr, "Invalid gang mode %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'q':
+            if (strcmp(optarg, "rr") == 0) {
+                sim_config.queue_discipline = QUEUE_RR;
+            } else if (strcmp(optarg, "mlfq") == 0) {
+                sim_config.queue_discipline = QUEUE_MLFQ;
+            } else {
+                fprintf(stderr, "Invalid queue discipline %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'e':
+            sim_config.elastic = 1;
+            break;
+        case 'k':
+            if (strcmp(optarg, "adaptive") == 0) {
+                sim_config.quantum_cycles = 0;
+            } else {
+                sim_config.quantum_cycles = atoi(optarg);
+                if (sim_config.quantum_cycles <= 0) {
+                    fprintf(stderr, "Invalid quantum %s\n", optarg);
+                    return 1;
+                }
+            }
+            break;
+        case 'r':
+            sim_config.trace_file = optarg;
+            break;
+        case 'T':
+            sim_config.topology_file = optarg;
+            break;
+        case 'w':
+            sim_config.work_kb = atoi(optarg);
+            if (sim_config.work_kb <= 0) {
+                fprintf(stderr, "Invalid working set size %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
         return 1;
     }
     
-    char* filename = argv[1];
+    char* filename = argv[optind];
 
-    // Try to open the input file
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("Couldn't open file , terminating. . .\n");
+    // Map the simulated cores onto the machine, flat index order without -T
+    topology_init_flat();
+    if (sim_config.topology_file != NULL && topology_load(sim_config.topology_file) != 0) {
+        printf("Couldn't read topology %s, terminating. . .\n", sim_config.topology_file);
+        return -1;
+    }
+
+    // Map and parse the input file
+    TaskSet task_set;
+    if (load_tasks(filename, &task_set) != 0) {
+        printf("Couldn't load %s, terminating. . .\n", filename);
         return -1;
     }
 
 
     // Initialize shared variables, call the student's function as well.
+    num_groups = task_set.num_groups;
     processor_queues = malloc(NUM_CORES * sizeof(WorkBalancerQueue*));
     for (int i = 0; i < NUM_CORES; i++) {
         processor_queues[i] = malloc(sizeof(WorkBalancerQueue));
@@ -82,38 +270,16 @@ int main(int argc, char* argv[]) {
     printf("Initialized %d processor_queues\n", NUM_CORES);
 
     
-    // Parse input file
-    char line[1024];
-    int processor_index = 0;
-    int registered_jobs = 0;
-    int max_runtime = INT_MIN;
-    while (fgets(line, sizeof(line), file)) { 
-        int core_runtime = 0;
-        int num;
-        char *token = strtok(line, " ");  
-        while (token != NULL) {
-            char string_part[1024];
-            int num;
-
-            if (sscanf(token, "%[^-]-%d", string_part, &num) == 2) {
-                Task* my_task = malloc(sizeof(Task));
-                my_task -> task_id = strdup(string_part);
-                my_task -> task_duration = num;
-                my_task -> cache_warmed_up = 1.0;
-                my_task -> owner = processor_queues[processor_index];
-                core_runtime += num;
-                submitTask(processor_queues[processor_index], my_task);
-                registered_jobs++;
-            }
-
-            token = strtok(NULL, " "); 
-        }
-        if (core_runtime > max_runtime) max_runtime = core_runtime;
-        processor_index++;
+    // Distribute the initial tasks, timed arrivals are released while the threads run
+    int registered_jobs = task_set.num_tasks;
+    int next_release = 0;
+    while (next_release < registered_jobs && task_set.releases[next_release].release_ms == 0) {
+        release_task(&task_set.releases[next_release++]);
     }
 
-    fclose(file);
     printf("Read file, starting multithreaded execution\n");
+    fflush(stdout);
+    sim_log_init(sim_config.log_level);
     // To print the initial state of cores after tasks are distributed
     // printf("Initial state of cores:\n");
     // for (int i = 0; i < NUM_CORES; i++) {
@@ -123,19 +289,25 @@ int main(int argc, char* argv[]) {
     // printf("---------------------------------------------\n");
 
     // Start threads
+    sim_stats_start(&task_set);
+    if (sim_config.trace_file != NULL) sim_trace_init(sim_config.trace_file, &task_set);
     pthread_t processor_ids[NUM_CORES];
     for (int i = 0; i < NUM_CORES; i++) {
         ThreadArguments* arg = malloc(sizeof(ThreadArguments));
         arg -> q = processor_queues[i];
         arg -> id = i;
-        int rc = pthread_create(&processor_ids[i], NULL, &processJobs, arg);
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        topology_pin(&attr, i);
+        int rc = pthread_create(&processor_ids[i], &attr, &processJobs, arg);
+        pthread_attr_destroy(&attr);
         if (rc) {
             printf("Error creating thread, terminating. . . ");
             return -1;
         }
     }
 
-    // Sleep until tasks are finished
+    // Sleep until tasks are finished, waking up in time to release timed arrivals
     // If you want to debug, you can uncomment this print block
     // to see a snapshot of the state of your queues, implement a print_queue method first
     while (!all_jobs_finished(registered_jobs)) {
@@ -143,16 +315,31 @@ int main(int argc, char* argv[]) {
         //     printf("Core %d: ", i);
         //     print_queue(processor_queues[i]);
         // }
-        usleep(2000 * 1000);
+        long now_ms = sim_time_ms();
+        while (next_release < registered_jobs && task_set.releases[next_release].release_ms <= now_ms) {
+            release_task(&task_set.releases[next_release++]);
+        }
+
+        long sleep_ms = 2000;
+        if (next_release < registered_jobs && task_set.releases[next_release].release_ms - now_ms < sleep_ms) {
+            sleep_ms = task_set.releases[next_release].release_ms - now_ms;
+        }
+        usleep(sleep_ms * 1000 / sim_config.time_scale);
     }
 
     stop_threads = 1;
 
+    // Make sure the buffered execution log is out before the final message
+    sim_log_flush();
     printf("All tasks finished, joining threads\n");
 
     for (int i = 0; i < NUM_CORES; i++) {
         pthread_join(processor_ids[i], NULL);
     }
+    sim_log_shutdown();
+    sim_trace_write();
+    if (sim_config.print_stats) sim_stats_print(&task_set);
+    free_tasks(&task_set);
 
     return 0;
 }
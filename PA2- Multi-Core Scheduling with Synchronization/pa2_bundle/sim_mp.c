@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "constants.h"
+#include "sim_config.h"
+#include "task_loader.h"
+#include "wbq_shm.h"
+
+// Multi-process driver for the shared memory WorkBalancerQueue in wbq_shm.c.
+// The supervisor loads the input into a shared memory segment and forks one
+// worker process per core. Each worker attaches the segment on its own, runs
+// its queue and steals from the others like the threads of sim do. When a
+// worker dies the supervisor puts its running task back and starts a new
+// worker for the core; -c kills a worker on purpose, while it holds its
+// queue mutex, to exercise that path.
+
+SimConfig sim_config = {
+    .log_level = SIM_LOG_ALL,
+    .time_scale = 1.0,
+};
+
+// Same cycle as executeJob in sim_methods.c, on a shared task
+void executeShmJob(ShmSegment* seg, int i, int my_id) {
+    ShmTask* task = &seg -> tasks[i];
+    if (task -> owner != my_id) {
+        task -> owner = my_id;
+        task -> cache_warmed_up = 1.0;
+    }
+
+    if (task -> task_duration - (CYCLE * task -> cache_warmed_up) <= 0) {
+        task -> task_duration = 0;
+        if (sim_config.log_level >= SIM_LOG_FINISHED) {
+            printf("Processor %d: Finished task %s\n", my_id, task -> task_id);
+        }
+    } else {
+        task -> task_duration -= CYCLE * task -> cache_warmed_up;
+        if (sim_config.log_level >= SIM_LOG_ALL) {
+            printf("Processor %d: Executed task %s, it has %d ms remaining\n", my_id, task -> task_id, task -> task_duration);
+        }
+        if (task -> cache_warmed_up < MAX_CACHE_FACTOR ) task -> cache_warmed_up += CACHE_FACTOR;
+    }
+    fflush(stdout);
+    usleep(CYCLE * 1000 / sim_config.time_scale);
+}
+
+// Steal from the tail of the core with the most queued work
+int steal_task(ShmSegment* seg, int my_id) {
+    int victim = -1, victim_work = 0;
+    for (int core = 0; core < seg -> num_cores; core++) {
+        if (core == my_id) continue;
+        int work = shmQueueWork(seg, core);
+        if (work > victim_work) {
+            victim = core;
+            victim_work = work;
+        }
+    }
+    return victim < 0 ? SHM_NIL : shmFetchTaskFromOthers(seg, victim, my_id);
+}
+
+void run_worker(const char* name, int my_id, int crash_after) {
+    // Map the segment again, it usually lands at another address than in the parent
+    ShmSegment* seg = shmAttach(name);
+    if (seg == NULL) {
+        fprintf(stderr, "Worker %d couldn't attach %s\n", my_id, name);
+        exit(EXIT_FAILURE);
+    }
+    seg -> queues[my_id].worker = getpid();
+
+    int cycles = 0;
+    while (shmFinishedTasks(seg) < seg -> num_tasks) {
+        int i = shmFetchTask(seg, my_id);
+        if (i == SHM_NIL) i = steal_task(seg, my_id);
+        if (i == SHM_NIL) {
+            usleep(1000);
+            continue;
+        }
+
+        executeShmJob(seg, i, my_id);
+
+        if (crash_after > 0 && ++cycles == crash_after) {
+            // Die mid run holding our own queue mutex
+            pthread_mutex_lock(&seg -> queues[my_id].mutex);
+            kill(getpid(), SIGKILL);
+        }
+
+        if (seg -> tasks[i].task_duration > 0) {
+            shmSubmitTask(seg, my_id, i);
+        } else {
+            shmFinishRun(seg, my_id);
+        }
+    }
+    shmDetach(seg);
+    exit(EXIT_SUCCESS);
+}
+
+pid_t spawn_worker(const char* name, int core, int crash_after) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) run_worker(name, core, crash_after);
+    return pid;
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "Incorrect call, usage: %s [options] <filename>\n", prog);
+    fprintf(stderr, "  -l <level>         log level: 0 off, 1 finished tasks only, 2 everything (default)\n");
+    fprintf(stderr, "  -x <scale>         run the simulated clock scale times faster than real time\n");
+    fprintf(stderr, "  -c <core:cycles>   kill the worker of core after it ran that many cycles\n");
+}
+
+int main(int argc, char* argv[]) {
+    int crash_core = -1, crash_after = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:x:c:")) != -1) {
+        switch (opt) {
+        case 'l': {
+            char* end;
+            long level = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || level < SIM_LOG_OFF || level > SIM_LOG_ALL) {
+                fprintf(stderr, "Invalid log level %s\n", optarg);
+                return 1;
+            }
+            sim_config.log_level = (SimLogLevel) level;
+            break;
+        }
+        case 'x':
+            sim_config.time_scale = atof(optarg);
+            if (sim_config.time_scale <= 0) {
+                fprintf(stderr, "Invalid time scale %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            if (sscanf(optarg, "%d:%d", &crash_core, &crash_after) != 2 || crash_core < 0 ||
+                crash_core >= NUM_CORES || crash_after <= 0) {
+                fprintf(stderr, "Invalid crash %s, expected core:cycles\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    TaskSet task_set;
+    if (load_tasks(argv[optind], &task_set) != 0) {
+        printf("Couldn't load %s, terminating. . .\n", argv[optind]);
+        return -1;
+    }
+    if (task_set.num_edges > 0 ||
+        (task_set.num_tasks > 0 && task_set.releases[task_set.num_tasks - 1].release_ms > 0)) {
+        fprintf(stderr, "sim_mp: release times and dependencies are ignored\n");
+    }
+
+    // Ids are copied into fixed size fields, a cut one would print wrong or collide
+    for (int i = 0; i < task_set.num_tasks; i++) {
+        if (strlen(task_set.tasks[i].task_id) >= SHM_ID_LEN) {
+            fprintf(stderr, "sim_mp: task id %s is longer than %d characters\n",
+                    task_set.tasks[i].task_id, SHM_ID_LEN - 1);
+            free_tasks(&task_set);
+            return -1;
+        }
+    }
+
+    // Copy the tasks into the segment and fill the initial queues
+    char name[64];
+    snprintf(name, sizeof(name), "/wbq_sim_mp_%d", (int) getpid());
+    ShmSegment* seg = shmCreate(name, NUM_CORES, task_set.num_tasks);
+    if (seg == NULL) {
+        perror("shmCreate");
+        return -1;
+    }
+    for (int r = 0; r < task_set.num_tasks; r++) {
+        TaskRelease* release = &task_set.releases[r];
+        int i = release -> task - task_set.tasks;
+        ShmTask* task = &seg -> tasks[i];
+        strcpy(task -> task_id, release -> task -> task_id);
+        task -> task_duration = release -> task -> task_duration;
+        task -> cache_warmed_up = 1.0;
+        int core = release -> core == RELEASE_ANY_CORE ? i % NUM_CORES : release -> core;
+        shmSubmitTask(seg, core, i);
+    }
+    free_tasks(&task_set);
+    printf("Initialized %d shared processor_queues in %s\n", NUM_CORES, name);
+
+    // One worker process per core
+    pid_t workers[NUM_CORES];
+    for (int core = 0; core < NUM_CORES; core++) {
+        workers[core] = spawn_worker(name, core, core == crash_core ? crash_after : 0);
+    }
+
+    // Supervise until every worker exits after the last task, restarting dead ones
+    int running = NUM_CORES, restarts = 0;
+    while (running > 0) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) break;
+        int core = 0;
+        while (core < NUM_CORES && workers[core] != pid) core++;
+        if (core == NUM_CORES) continue;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+            running--;
+            continue;
+        }
+        printf("Worker of core %d (pid %d) died, recovering its queue\n", core, (int) pid);
+        shmRecoverCore(seg, core);
+        if (shmFinishedTasks(seg) < seg -> num_tasks) {
+            workers[core] = spawn_worker(name, core, 0);
+            restarts++;
+        } else {
+            running--;
+        }
+    }
+
+    int recoveries = 0;
+    for (int core = 0; core < NUM_CORES; core++) recoveries += seg -> queues[core].recoveries;
+    printf("All tasks finished, %d of %d, %d workers restarted, %d queues rebuilt\n",
+           shmFinishedTasks(seg), seg -> num_tasks, restarts, recoveries);
+    shmDestroy(name, seg);
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "constants.h"
+#include "sim_config.h"
+#include "sim_stats.h"
+#include "real_work.h"
+
+SimStats sim_stats;
+
+long cycles_to_finish(int duration, double warm) {
+    // Mirrors the arithmetic of executeJob, including the integer truncation
+    long cycles = 1;
+    while (duration - (CYCLE * warm) > 0) {
+        duration -= CYCLE * warm;
+        if (warm < MAX_CACHE_FACTOR) warm += CACHE_FACTOR;
+        cycles++;
+    }
+    return cycles;
+}
+
+// Fewest cycles a task can take in gang mode, when every cycle co-runs with
+// its group and gains GANG_CACHE_BONUS on top of CACHE_FACTOR. executeJob can
+// overshoot MAX_CACHE_FACTOR by less than one CACHE_FACTOR, so that is the cap.
+static long gang_cycles_to_finish(int duration) {
+    double warm = 1.0;
+    long cycles = 1;
+    while (duration - (CYCLE * warm) > 0) {
+        duration -= CYCLE * warm;
+        warm += CACHE_FACTOR + GANG_CACHE_BONUS;
+        if (warm > MAX_CACHE_FACTOR + CACHE_FACTOR) warm = MAX_CACHE_FACTOR + CACHE_FACTOR;
+        cycles++;
+    }
+    return cycles;
+}
+
+void sim_stats_start(const TaskSet* set) {
+    memset(&sim_stats, 0, sizeof(sim_stats));
+
+    // No schedule beats the critical path or a perfect split of the total
+    // work, both measured without any migration. The critical path is the
+    // latest finish when every task starts as soon as it is released and
+    // its predecessors are done, on unlimited cores. With the gang cache
+    // bonus tasks are assumed to co-run with their group the whole time.
+    long* ready_ms = calloc(set -> num_tasks + 1, sizeof(long));
+    for (int i = 0; i < set -> num_tasks; i++) {
+        const Task* task = set -> order[i];
+        long task_ms = (sim_config.gang_mode != GANG_OFF ? gang_cycles_to_finish(task -> task_duration)
+                                                         : cycles_to_finish(task -> task_duration, 1.0)) * CYCLE;
+        sim_stats.total_work_ms += task_ms;
+
+        // All predecessors already finished here, they come first in order
+        long start_ms = ready_ms[task - set -> tasks];
+        if (start_ms < task -> release_ms) start_ms = task -> release_ms;
+        long finish_ms = start_ms + task_ms;
+        if (finish_ms > sim_stats.critical_path_ms) sim_stats.critical_path_ms = finish_ms;
+
+        // Successors can't start before this one finished
+        for (int s = 0; s < task -> num_successors; s++) {
+            long* successor_ready_ms = &ready_ms[task -> successors[s] - set -> tasks];
+            if (*successor_ready_ms < finish_ms) *successor_ready_ms = finish_ms;
+        }
+    }
+    free(ready_ms);
+    long split_ms = (sim_stats.total_work_ms + NUM_CORES - 1) / NUM_CORES;
+    sim_stats.lower_bound_ms = sim_stats.critical_path_ms > split_ms ? sim_stats.critical_path_ms : split_ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &sim_stats.start_time);
+}
+
+long sim_time_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wall_ms = (now.tv_sec - sim_stats.start_time.tv_sec) * 1000.0 +
+                     (now.tv_nsec - sim_stats.start_time.tv_nsec) / 1000000.0;
+    return (long) (wall_ms * sim_config.time_scale);
+}
+
+static int compare_long(const void* a, const void* b) {
+    long x = *(const long*) a;
+    long y = *(const long*) b;
+    return (x > y) - (x < y);
+}
+
+void sim_stats_print(const TaskSet* set) {
+    long makespan_ms = 0;
+    long busy_ms[NUM_CORES];
+    long max_busy_ms = 0;
+    long total_busy_ms = 0;
+    long total_steals = 0;
+    long total_pushes = 0;
+
+    for (int i = 0; i < NUM_CORES; i++) {
+        if (sim_stats.last_finish_ms[i] > makespan_ms) makespan_ms = sim_stats.last_finish_ms[i];
+        busy_ms[i] = sim_stats.busy_cycles[i] * CYCLE;
+        if (busy_ms[i] > max_busy_ms) max_busy_ms = busy_ms[i];
+        total_busy_ms += busy_ms[i];
+        total_steals += sim_stats.steals[i];
+        total_pushes += sim_stats.pushes[i];
+    }
+    double mean_busy_ms = (double) total_busy_ms / NUM_CORES;
+
+    // Turnaround of every task, from its release to its last cycle
+    double mean_turnaround_ms = 0;
+    long p99_turnaround_ms = 0;
+    if (set -> num_tasks > 0) {
+        long* turnaround_ms = malloc(set -> num_tasks * sizeof(long));
+        for (int i = 0; i < set -> num_tasks; i++) {
+            const Task* task = &set -> tasks[i];
+            turnaround_ms[i] = task -> finish_ms - task -> release_ms;
+            mean_turnaround_ms += turnaround_ms[i];
+        }
+        mean_turnaround_ms /= set -> num_tasks;
+        qsort(turnaround_ms, set -> num_tasks, sizeof(long), compare_long);
+        p99_turnaround_ms = turnaround_ms[(set -> num_tasks * 99 - 1) / 100];
+        free(turnaround_ms);
+    }
+
+    static const char* balance_names[] = { "pull", "push", "hybrid" };
+    static const char* queue_names[] = { "rr", "mlfq" };
+
+    printf("---------------------------------------------\n");
+    printf("Balance mode: %s, queue: %s, quantum: ", balance_names[sim_config.balance_mode],
+           queue_names[sim_config.queue_discipline]);
+    if (sim_config.quantum_cycles > 0) {
+        printf("%d cycles\n", sim_config.quantum_cycles);
+    } else {
+        printf("adaptive\n");
+    }
+    printf("Makespan: %ld ms (lower bound %ld ms, ratio %.2f)\n", makespan_ms,
+           sim_stats.lower_bound_ms,
+           sim_stats.lower_bound_ms > 0 ? (double) makespan_ms / sim_stats.lower_bound_ms : 0.0);
+    printf("Critical path bound: %ld ms (ratio %.2f)\n", sim_stats.critical_path_ms,
+           sim_stats.critical_path_ms > 0 ? (double) makespan_ms / sim_stats.critical_path_ms : 0.0);
+    printf("Turnaround: %.0f ms average, %ld ms p99\n", mean_turnaround_ms, p99_turnaround_ms);
+
+    // Group completion, from the first release to the last finish of its tasks
+    if (set -> num_groups > 0) {
+        long* group_start_ms = malloc(set -> num_groups * sizeof(long));
+        long* group_finish_ms = malloc(set -> num_groups * sizeof(long));
+        for (int g = 0; g < set -> num_groups; g++) {
+            group_start_ms[g] = LONG_MAX;
+            group_finish_ms[g] = 0;
+        }
+        for (int i = 0; i < set -> num_tasks; i++) {
+            const Task* task = &set -> tasks[i];
+            if (task -> release_ms < group_start_ms[task -> group]) group_start_ms[task -> group] = task -> release_ms;
+            if (task -> finish_ms > group_finish_ms[task -> group]) group_finish_ms[task -> group] = task -> finish_ms;
+        }
+        double mean_group_ms = 0;
+        long max_group_ms = 0;
+        for (int g = 0; g < set -> num_groups; g++) {
+            long group_ms = group_finish_ms[g] - group_start_ms[g];
+            mean_group_ms += group_ms;
+            if (group_ms > max_group_ms) max_group_ms = group_ms;
+        }
+        mean_group_ms /= set -> num_groups;
+        printf("Group completion: %.0f ms average, %ld ms max over %d groups\n", mean_group_ms, max_group_ms,
+               set -> num_groups);
+        free(group_start_ms);
+        free(group_finish_ms);
+    }
+    printf("Load imbalance: %.2f (max/mean busy time)\n",
+           mean_busy_ms > 0 ? max_busy_ms / mean_busy_ms : 0.0);
+    printf("Steals: %ld, pushes: %ld\n", total_steals, total_pushes);
+    long total_injected = 0, total_slot_hits = 0;
+    for (int i = 0; i < NUM_CORES; i++) {
+        total_injected += sim_stats.injected[i];
+        total_slot_hits += sim_stats.slot_hits[i];
+    }
+    long total_cycles = 0, total_dispatches = 0;
+    for (int i = 0; i < NUM_CORES; i++) {
+        total_cycles += sim_stats.busy_cycles[i];
+        total_dispatches += sim_stats.dispatches[i];
+    }
+    if (sim_config.gang_mode != GANG_OFF) {
+        long total_corun = 0, total_gang_pulls = 0;
+        for (int i = 0; i < NUM_CORES; i++) {
+            total_corun += sim_stats.corun_cycles[i];
+            total_gang_pulls += sim_stats.gang_pulls[i];
+        }
+        printf("Co-run cycles: %.0f%%, gang pulls: %ld\n", total_cycles > 0 ? 100.0 * total_corun / total_cycles : 0.0,
+               total_gang_pulls);
+    }
+    printf("Dispatches: %ld, %.2f cycles per dispatch\n", total_dispatches,
+           total_dispatches > 0 ? (double) total_cycles / total_dispatches : 0.0);
+    printf("Injected: %ld, next slot hits: %ld\n", total_injected, total_slot_hits);
+    if (topology.loaded) {
+        printf("Steals by distance:");
+        for (int level = 0; level < TOPO_LEVELS; level++) {
+            long steals = 0;
+            for (int i = 0; i < NUM_CORES; i++) steals += sim_stats.steal_distance[i][level];
+            printf(" %s %ld%s", topology_distance_name(level), steals, level < TOPO_LEVELS - 1 ? "," : "\n");
+        }
+    }
+    // Core time the run occupied, parked cores don't count
+    long active_ms = 0;
+    for (int i = 0; i < NUM_CORES; i++) {
+        long parked_ms = sim_stats.parked_ms[i];
+        if (sim_stats.parked_at_exit[i] && sim_stats.exit_park_start_ms[i] < makespan_ms) {
+            parked_ms += makespan_ms - sim_stats.exit_park_start_ms[i];
+        }
+        active_ms += parked_ms < makespan_ms ? makespan_ms - parked_ms : 0;
+    }
+    printf("Core time: %.1f core-s active of %.1f, %.0f%% of active time busy\n", active_ms / 1000.0,
+           NUM_CORES * makespan_ms / 1000.0, active_ms > 0 ? 100.0 * total_busy_ms / active_ms : 0.0);
+    printf("Busy time per core:");
+    for (int i = 0; i < NUM_CORES; i++) {
+        printf(" %ld", busy_ms[i]);
+    }
+    printf(" ms\n");
+    if (sim_config.work_kb > 0) real_work_print();
+}
@@ -0,0 +1,45 @@
+#ifndef SIM_STATS_H
+#define SIM_STATS_H
+
+#include <time.h>
+#include "constants.h"
+#include "task_loader.h"
+#include "topology.h"
+
+// Counters collected while the simulation runs. Each per-core slot is only
+// written by its own core thread and read by main after the threads joined.
+typedef struct SimStats {
+    struct timespec start_time;
+    long busy_cycles[NUM_CORES];        // Cycles spent in executeJob
+    long dispatches[NUM_CORES];         // Times a task was picked to run for a quantum
+    long steals[NUM_CORES];             // Tasks taken from other cores' queues
+    long pushes[NUM_CORES];             // Tasks handed to other cores' queues
+    long injected[NUM_CORES];           // Tasks taken from the global injection queue
+    long slot_hits[NUM_CORES];          // Tasks run from the next task slot
+    long corun_cycles[NUM_CORES];       // Cycles run next to another task of the same group
+    long gang_pulls[NUM_CORES];         // Gang tasks taken from other cores' queues
+    long steal_distance[NUM_CORES][TOPO_LEVELS];    // Steals by distance to the victim
+    long last_finish_ms[NUM_CORES];     // Simulated time of the last finished task
+    long parked_ms[NUM_CORES];          // Simulated time spent parked in elastic mode
+    int parked_at_exit[NUM_CORES];      // Core was still parked when the threads stopped
+    long exit_park_start_ms[NUM_CORES]; // Start of that last parking
+    long lower_bound_ms;                // Best possible makespan of the input
+    long critical_path_ms;              // Longest release plus dependency chain
+    long total_work_ms;                 // Sum of all cycles needed without migration, fewest in gang mode
+} SimStats;
+
+extern SimStats sim_stats;
+
+// Cycles executeJob needs to finish duration ms starting from cache factor warm.
+long cycles_to_finish(int duration, double warm);
+
+// Compute the lower bound of set and start the simulated clock.
+void sim_stats_start(const TaskSet* set);
+
+// Simulated milliseconds since sim_stats_start.
+long sim_time_ms();
+
+// Print the run summary, set must be the input the simulation ran on.
+void sim_stats_print(const TaskSet* set);
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "constants.h"
+#include "sim_config.h"
+#include "sim_stats.h"
+#include "sim_trace.h"
+
+#define TRACE_INITIAL_EVENTS 4096
+
+// Events of one core, grown by doubling and only touched by that core
+typedef struct TraceBuffer {
+    TraceEvent* events;
+    size_t count;
+    size_t capacity;
+} TraceBuffer;
+
+static TraceBuffer buffers[NUM_CORES];
+static const TaskSet* trace_set;
+static const char* trace_filename;
+
+static uint64_t trace_time_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wall_us = (now.tv_sec - sim_stats.start_time.tv_sec) * 1000000.0 +
+                     (now.tv_nsec - sim_stats.start_time.tv_nsec) / 1000.0;
+    return (uint64_t) (wall_us * sim_config.time_scale);
+}
+
+void sim_trace_init(const char* filename, const TaskSet* set) {
+    trace_filename = filename;
+    trace_set = set;
+    for (int i = 0; i < NUM_CORES; i++) {
+        buffers[i].events = malloc(TRACE_INITIAL_EVENTS * sizeof(TraceEvent));
+        buffers[i].count = 0;
+        buffers[i].capacity = TRACE_INITIAL_EVENTS;
+        if (buffers[i].events == NULL) {
+            perror("sim_trace_init");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void sim_trace(int my_id, TraceEventType type, const Task* task, int other, int value) {
+    if (trace_set == NULL) return;
+
+    TraceBuffer* buffer = &buffers[my_id];
+    if (buffer->count == buffer->capacity) {
+        TraceEvent* events = realloc(buffer->events, 2 * buffer->capacity * sizeof(TraceEvent));
+        if (events == NULL) return;     // Drop the event rather than stop the core
+        buffer->events = events;
+        buffer->capacity *= 2;
+    }
+
+    TraceEvent* e = &buffer->events[buffer->count++];
+    memset(e, 0, sizeof(*e));
+    e->time_us = trace_time_us();
+    e->task = task != NULL ? (int32_t) (task - trace_set->tasks) : TRACE_NO_TASK;
+    e->value = value;
+    e->core = my_id;
+    e->other = other;
+    e->type = type;
+}
+
+void sim_trace_write() {
+    if (trace_set == NULL) return;
+
+    FILE* file = fopen(trace_filename, "wb");
+    if (file == NULL) {
+        perror(trace_filename);
+    } else {
+        TraceHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.num_cores = NUM_CORES;
+        header.num_tasks = trace_set->num_tasks;
+        header.cycle_ms = CYCLE;
+        fwrite(&header, sizeof(header), 1, file);
+
+        for (int i = 0; i < trace_set->num_tasks; i++) {
+            const char* id = trace_set->tasks[i].task_id;
+            uint16_t length = strlen(id);
+            fwrite(&length, sizeof(length), 1, file);
+            fwrite(id, 1, length, file);
+        }
+        for (int i = 0; i < NUM_CORES; i++) {
+            fwrite(buffers[i].events, sizeof(TraceEvent), buffers[i].count, file);
+        }
+        fclose(file);
+    }
+
+    for (int i = 0; i < NUM_CORES; i++) {
+        free(buffers[i].events);
+        buffers[i].events = NULL;
+    }
+    trace_set = NULL;
+}
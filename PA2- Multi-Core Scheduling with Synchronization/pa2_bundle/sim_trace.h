@@ -0,0 +1,63 @@
+#ifndef SIM_TRACE_H
+#define SIM_TRACE_H
+
+#include <stdint.h>
+#include "wbq.h"
+#include "task_loader.h"
+
+// Binary scheduling trace. Each core appends fixed size events to its own
+// buffer while the simulation runs, the buffers are written to one file
+// after the threads joined. trace_tool turns the file into a Chrome or
+// Perfetto trace or an ASCII Gantt chart.
+//
+// File layout, all integers little endian as written by the simulator:
+//   TraceHeader
+//   num_tasks times: uint16_t length, id bytes without terminator
+//   TraceEvent records until the end of the file, grouped by core
+
+#define TRACE_MAGIC "WBQTRACE"
+#define TRACE_VERSION 1
+#define TRACE_NO_TASK -1
+
+typedef enum TraceEventType {
+    TRACE_SLICE_START,      // Core starts one cycle of task
+    TRACE_SLICE_END,        // Cycle done, value is the remaining duration
+    TRACE_STEAL,            // Core took task from the queue of other
+    TRACE_PUSH,             // Core gave task to the queue of other
+    TRACE_IDLE,             // Core found no work, value is the sleep in simulated us
+    TRACE_RESUBMIT,         // Unfinished task went back to the core's queue
+    TRACE_RELEASE,          // Task became ready on the queue of core
+    TRACE_INJECTED,         // Core took task from the global injection queue
+    TRACE_PARK,             // Core parked, value is the work in ms left on the other cores
+    TRACE_UNPARK            // Core woke up from parking
+} TraceEventType;
+
+typedef struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_cores;
+    uint32_t num_tasks;
+    uint32_t cycle_ms;
+} TraceHeader;
+
+typedef struct TraceEvent {
+    uint64_t time_us;       // Simulated time since the start
+    int32_t task;           // Index of the task in file order, or TRACE_NO_TASK
+    int32_t value;
+    int16_t core;
+    int16_t other;          // Victim of a steal, target of a push, -1 otherwise
+    uint8_t type;
+    uint8_t pad[3];
+} TraceEvent;
+
+// Start recording for the tasks of set into filename, before the threads start.
+void sim_trace_init(const char* filename, const TaskSet* set);
+
+// Record an event from core my_id, only the owning core may call this.
+// Does nothing unless tracing was started.
+void sim_trace(int my_id, TraceEventType type, const Task* task, int other, int value);
+
+// Write the trace file and free the buffers, after the threads joined.
+void sim_trace_write();
+
+#endif
@@ -1,80 +1,238 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <time.h>
+#include <unistd.h>
+#include "constants.h"
 
 // This program enablues you to create a sample task input document
 // for the simulator. The format of an individual task is ID-dur.
 // Where ID is the task name and dur is the duration in ms.
-// Each line denotes the initial queue of a separate processor. 
+// Each line denotes the initial queue of a separate processor.
 // The tasks in each line are separated by a space character ' '
+// A line starting with "@ms core" releases its tasks on that core
+// at simulated time ms, the bursty distribution uses these lines.
+// A task written as ID-dur:P1,P2 waits for tasks P1 and P2 to finish,
+// the dag distribution uses these dependencies.
+// A line starting with "@ms *" releases its tasks into the global
+// injection queue instead of one core, the inject distribution uses these.
 
 // Note: To play around with different values, play with the calculation of ret.
 // ret is calculated as rand() % (max - min + 1) + min
 // For example to get jobs with a duration between [50, 400],
 // we write ret = rand() % (400 - 50 + 1) + 50
-// the % 100 line is there to round down last two digits. 
+// the % 100 line is there to round down last two digits.
+
+#define ZIPF_RANKS 50       // Zipf durations are rank * 100 ms, up to 5000 ms
+
+typedef enum Distribution {
+    DIST_UNIFORM,           // Even mix of heavy and light tasks on every core
+    DIST_ZIPF,              // Heavy tailed durations, most tasks are short
+    DIST_BIMODAL,           // Many tiny tasks and a few very long ones
+    DIST_ONECORE,           // All of the work starts on the first core
+    DIST_BURSTY,            // Light initial load, then bursts arriving on single cores
+    DIST_DAG,               // Uniform tasks, half of them depending on tasks of earlier lines
+    DIST_INJECT             // Like bursty, but the bursts go to the injection queue
+} Distribution;
+
+static const char* distribution_names[] = { "uniform", "zipf", "bimodal", "onecore", "bursty", "dag", "inject" };
+
+static double zipf_cdf[ZIPF_RANKS];
 
 // Function to generate heavy tasks (between 2000 and 5000)
 int generate_heavy_task() {
     int ret = rand() % (5000 - 2000 + 1) + 2000;
     ret -= ret % 100;
-    return ret; 
+    return ret;
 }
 
 // Function to generate light tasks (between 500 and 2000)
 int generate_light_task() {
     int ret = rand() % (2000 - 500 + 1) + 500;
     ret -= ret % 100;
-    return ret; 
+    return ret;
+}
+
+// Precompute the cumulative distribution of the Zipf ranks
+void init_zipf(double alpha) {
+    double sum = 0;
+    for (int k = 1; k <= ZIPF_RANKS; k++) {
+        sum += 1.0 / pow(k, alpha);
+        zipf_cdf[k - 1] = sum;
+    }
+    for (int k = 0; k < ZIPF_RANKS; k++) {
+        zipf_cdf[k] /= sum;
+    }
+}
+
+// Function to generate Zipf distributed tasks (between 100 and 5000)
+int generate_zipf_task() {
+    double u = (double) rand() / RAND_MAX;
+    int lo = 0, hi = ZIPF_RANKS - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo + 1) * 100;
+}
+
+// Function to generate bimodal tasks, 85% between 50 and 300, the rest between 3000 and 6000
+int generate_bimodal_task() {
+    int ret;
+    if (rand() % 100 < 85) {
+        ret = rand() % (300 - 50 + 1) + 50;
+    } else {
+        ret = rand() % (6000 - 3000 + 1) + 3000;
+    }
+    ret -= ret % 10;
+    return ret;
+}
+
+int generate_task(Distribution dist) {
+    switch (dist) {
+    case DIST_ZIPF:
+        return generate_zipf_task();
+    case DIST_BIMODAL:
+        return generate_bimodal_task();
+    default:
+        // Randomly choose between heavy and light task
+        return rand() % 2 == 0 ? generate_heavy_task() : generate_light_task();
+    }
+}
+
+int random_entries(int min_entries_per_line, int max_entries_per_line) {
+    return rand() % (max_entries_per_line - min_entries_per_line + 1) + min_entries_per_line;
 }
 
 // Function to generate tasks and write to a file
-void generate_tasks(int n, int min_entries_per_line, int max_entries_per_line) {
-    FILE *file = fopen("tasks.txt", "w");
+void generate_tasks(const char* filename, Distribution dist, int n, int min_entries_per_line, int max_entries_per_line) {
+    FILE *file = fopen(filename, "w");
     if (file == NULL) {
         perror("Error opening file");
         exit(EXIT_FAILURE);
     }
 
+    // Number of tasks on each line, dependencies only point to existing tasks
+    int* line_entries = calloc(n, sizeof(int));
+
     // Loop through the number of lines
     for (int i = 0; i < n; i++) {
         char task_prefix = 'A' + i; // Starting from 'A' for each line
-        int num_entries = rand() % (max_entries_per_line - min_entries_per_line + 1) + min_entries_per_line;
+        int num_entries;
+        if (dist == DIST_ONECORE) {
+            // The first core gets the work of all cores, the others start empty
+            num_entries = 0;
+            if (i == 0) {
+                for (int j = 0; j < n; j++) num_entries += random_entries(min_entries_per_line, max_entries_per_line);
+            }
+        } else if (dist == DIST_BURSTY || dist == DIST_INJECT) {
+            num_entries = min_entries_per_line;
+        } else {
+            num_entries = random_entries(min_entries_per_line, max_entries_per_line);
+        }
 
         // Generate tasks for the current line
         for (int j = 1; j <= num_entries; j++) {
-            int duration;
-            if (rand() % 2 == 0) { // Randomly choose between heavy and light task
-                duration = generate_heavy_task();
-            } else {
-                duration = generate_light_task();
+            int duration = generate_task(dist == DIST_BURSTY || dist == DIST_INJECT ? DIST_BIMODAL : dist);
+            fprintf(file, "%cTask%d-%d", task_prefix, j, duration); // Write to file
+            if (dist == DIST_DAG && i > 0 && rand() % 2 == 0) {
+                int pred_line = rand() % i;
+                if (line_entries[pred_line] > 0) {
+                    fprintf(file, ":%cTask%d", 'A' + pred_line, rand() % line_entries[pred_line] + 1);
+                }
             }
-            fprintf(file, "%cTask%d-%d ", task_prefix, j, duration); // Write to file
+            fprintf(file, " ");
         }
+        line_entries[i] = num_entries;
         fprintf(file, "\n"); // New line after each line of tasks
     }
 
+    // Bursts of heavy work land on one random core each, 1 to 4 seconds apart,
+    // or on whichever cores are idle for inject
+    if (dist == DIST_BURSTY || dist == DIST_INJECT) {
+        long release_ms = 0;
+        for (int b = 1; b <= n; b++) {
+            release_ms += rand() % (4000 - 1000 + 1) + 1000;
+            if (dist == DIST_INJECT) {
+                fprintf(file, "@%ld * ", release_ms);
+            } else {
+                // Lines past NUM_CORES wrap around, core numbers don't
+                fprintf(file, "@%ld %d ", release_ms, rand() % (n < NUM_CORES ? n : NUM_CORES));
+            }
+            int num_entries = 2 * max_entries_per_line;
+            for (int j = 1; j <= num_entries; j++) {
+                fprintf(file, "Burst%dTask%d-%d ", b, j, generate_task(DIST_UNIFORM));
+            }
+            fprintf(file, "\n");
+        }
+    }
+
+    free(line_entries);
     fclose(file);
 }
 
-int main() {
-    srand(time(NULL)); // Seed for random number generation
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-c cores] [-m min] [-M max] [-d dist] [-a alpha] [-s seed] [-o file]\n", prog);
+    fprintf(stderr, "  -c <cores>   number of lines, one per core (default 8), bursts only\n"
+                    "               land on the first %d cores\n", NUM_CORES);
+    fprintf(stderr, "  -m <min>     minimum entries per line (default 5)\n");
+    fprintf(stderr, "  -M <max>     maximum entries per line (default 10)\n");
+    fprintf(stderr, "  -d <dist>    uniform, zipf, bimodal, onecore, bursty, dag or inject (default uniform)\n");
+    fprintf(stderr, "  -a <alpha>   exponent of the zipf distribution (default 1.1)\n");
+    fprintf(stderr, "  -s <seed>    random seed (default current time)\n");
+    fprintf(stderr, "  -o <file>    output file (default tasks.txt)\n");
+}
 
-    int n, min_entries_per_line, max_entries_per_line;
+int main(int argc, char* argv[]) {
+    int n = 8, min_entries_per_line = 5, max_entries_per_line = 10;
+    Distribution dist = DIST_UNIFORM;
+    double alpha = 1.1;
+    unsigned int seed = time(NULL);
+    const char* filename = "tasks.txt";
 
-    // Input the number of lines and entry limits
-    printf("Enter the number of lines: ");
-    scanf("%d", &n);
-    printf("Enter the minimum entries per line: ");
-    scanf("%d", &min_entries_per_line);
-    printf("Enter the maximum entries per line: ");
-    scanf("%d", &max_entries_per_line);
+    int opt;
+    while ((opt = getopt(argc, argv, "c:m:M:d:a:s:o:")) != -1) {
+        switch (opt) {
+        case 'c': n = atoi(optarg); break;
+        case 'm': min_entries_per_line = atoi(optarg); break;
+        case 'M': max_entries_per_line = atoi(optarg); break;
+        case 'a': alpha = atof(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 10); break;
+        case 'o': filename = optarg; break;
+        case 'd': {
+            int found = 0;
+            for (int i = 0; i < (int) (sizeof(distribution_names) / sizeof(*distribution_names)); i++) {
+                if (strcmp(optarg, distribution_names[i]) == 0) {
+                    dist = (Distribution) i;
+                    found = 1;
+                }
+            }
+            if (!found) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (n <= 0 || min_entries_per_line < 0 || max_entries_per_line < min_entries_per_line) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    srand(seed); // Seed for random number generation
+    init_zipf(alpha);
 
     // Generate tasks and write to the file
-    generate_tasks(n, min_entries_per_line, max_entries_per_line);
+    generate_tasks(filename, dist, n, min_entries_per_line, max_entries_per_line);
+
+    printf("Tasks generated and written to %s\n", filename);
 
-    printf("Tasks generated and written to tasks.txt\n");
-    
     return 0;
 }
 
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "constants.h"
+#include "task_loader.h"
+#include "sim_stats.h"
+
+// Open addressing table used to intern task ids while scanning. Each slot
+// also remembers the first task carrying the id, for predecessor lookups.
+typedef struct InternTable {
+    char** slots;
+    Task** owners;
+    size_t mask;
+    char* pool;             // Next free byte in the id arena
+} InternTable;
+
+// Dependency read from the file, resolved once every task is known
+typedef struct Edge {
+    Task* task;
+    size_t pred_slot;
+} Edge;
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static uint64_t hash_id(const char* s, size_t len) {
+    uint64_t h = 1469598103934665603ULL;    // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Returns the slot of the interned copy of s
+static size_t intern(InternTable* t, const char* s, size_t len) {
+    size_t i = hash_id(s, len) & t->mask;
+    while (t->slots[i] != NULL) {
+        if (strncmp(t->slots[i], s, len) == 0 && t->slots[i][len] == '\0') {
+            return i;
+        }
+        i = (i + 1) & t->mask;
+    }
+    char* id = t->pool;
+    memcpy(id, s, len);
+    id[len] = '\0';
+    t->pool += len + 1;
+    t->slots[i] = id;
+    return i;
+}
+
+// Parse an unsigned decimal number at *p, returns -1 if there is none
+static long scan_number(const char** p, const char* end) {
+    const char* s = *p;
+    long value = 0;
+    if (s == end || *s < '0' || *s > '9') return -1;
+    while (s < end && *s >= '0' && *s <= '9') {
+        if (value < (LONG_MAX - 9) / 10) value = value * 10 + (*s - '0');
+        s++;
+    }
+    *p = s;
+    return value;
+}
+
+// Count whitespace separated tokens, an upper bound for the number of tasks,
+// and predecessor separators, an upper bound for the number of edges
+static size_t count_tokens(const char* p, const char* end, size_t* separators) {
+    size_t tokens = 0;
+    int in_token = 0;
+    *separators = 0;
+    for (; p < end; p++) {
+        int sep = is_space(*p) || *p == '\n';
+        if (!sep && !in_token) tokens++;
+        if (*p == ':' || *p == ',') (*separators)++;
+        in_token = !sep;
+    }
+    return tokens;
+}
+
+static int compare_release(const void* a, const void* b) {
+    const TaskRelease* x = a;
+    const TaskRelease* y = b;
+    if (x->release_ms != y->release_ms) return x->release_ms < y->release_ms ? -1 : 1;
+    // Keep file order between tasks released at the same time
+    return x->task < y->task ? -1 : (x->task > y->task);
+}
+
+// Build successor lists from the edges and a topological order of the tasks.
+// Returns -1 on an unknown predecessor or a cycle.
+static int link_tasks(const char* filename, TaskSet* set, InternTable* table, Edge* edges) {
+    int* out_degree = calloc(set->num_tasks + 1, sizeof(int));
+    int* in_degree = calloc(set->num_tasks + 1, sizeof(int));
+    Task** preds = malloc((set->num_edges + 1) * sizeof(Task*));
+    set->successors = malloc((set->num_edges + 1) * sizeof(Task*));
+    set->order = malloc((set->num_tasks + 1) * sizeof(Task*));
+    int ok = out_degree != NULL && in_degree != NULL && preds != NULL &&
+             set->successors != NULL && set->order != NULL;
+
+    for (int e = 0; ok && e < set->num_edges; e++) {
+        preds[e] = table->owners[edges[e].pred_slot];
+        if (preds[e] == NULL) {
+            fprintf(stderr, "%s: task %s depends on unknown task %s\n", filename,
+                    edges[e].task->task_id, table->slots[edges[e].pred_slot]);
+            ok = 0;
+            break;
+        }
+        out_degree[preds[e] - set->tasks]++;
+        in_degree[edges[e].task - set->tasks]++;
+    }
+
+    if (ok) {
+        // Carve the successor lists out of one array
+        Task** next = set->successors;
+        for (int i = 0; i < set->num_tasks; i++) {
+            set->tasks[i].successors = next;
+            next += out_degree[i];
+        }
+        for (int e = 0; e < set->num_edges; e++) {
+            preds[e]->successors[preds[e]->num_successors++] = edges[e].task;
+        }
+
+        // Kahn's algorithm, the order array doubles as the work list
+        int head = 0, tail = 0;
+        for (int i = 0; i < set->num_tasks; i++) {
+            if (in_degree[i] == 0) set->order[tail++] = &set->tasks[i];
+        }
+        while (head < tail) {
+            Task* task = set->order[head++];
+            for (int s = 0; s < task->num_successors; s++) {
+                if (--in_degree[task->successors[s] - set->tasks] == 0) {
+                    set->order[tail++] = task->successors[s];
+                }
+            }
+        }
+        if (tail != set->num_tasks) {
+            fprintf(stderr, "%s: dependency cycle between tasks\n", filename);
+            ok = 0;
+        }
+    }
+
+    if (ok) {
+        // Longest chain of cold cycles from each task to the end of the graph
+        for (int i = set->num_tasks - 1; i >= 0; i--) {
+            Task* task = set->order[i];
+            long longest_successor_ms = 0;
+            for (int s = 0; s < task->num_successors; s++) {
+                if (task->successors[s]->critical_ms > longest_successor_ms) {
+                    longest_successor_ms = task->successors[s]->critical_ms;
+                }
+            }
+            task->critical_ms = cycles_to_finish(task->task_duration, 1.0) * CYCLE + longest_successor_ms;
+        }
+    }
+
+    free(out_degree);
+    free(in_degree);
+    free(preds);
+    return ok ? 0 : -1;
+}
+
+int load_tasks(const char* filename, TaskSet* set) {
+    memset(set, 0, sizeof(*set));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    const char* data = NULL;
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise((void*) data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    const char* end = data + size;
+    size_t max_edges;
+    size_t max_tasks = count_tokens(data, end, &max_edges);
+    size_t max_ids = max_tasks + max_edges;
+
+    InternTable table;
+    table.mask = 1;
+    while (table.mask < 2 * max_ids + 1) table.mask <<= 1;
+    table.slots = calloc(table.mask, sizeof(char*));
+    table.owners = calloc(table.mask, sizeof(Task*));
+    table.mask--;
+    Edge* edges = malloc((max_edges + 1) * sizeof(Edge));
+    set->ids = malloc(size + max_ids + 1);
+    set->tasks = malloc((max_tasks + 1) * sizeof(Task));
+    set->releases = malloc((max_tasks + 1) * sizeof(TaskRelease));
+    int ok = table.slots != NULL && table.owners != NULL && edges != NULL &&
+             set->ids != NULL && set->tasks != NULL && set->releases != NULL;
+    table.pool = set->ids;
+
+    // Group names only live while loading, tasks keep a group index
+    InternTable groups;
+    groups.mask = table.mask;
+    groups.slots = calloc(groups.mask + 1, sizeof(char*));
+    groups.owners = NULL;
+    char* group_pool = malloc(size + max_tasks + 1);
+    int* group_of_slot = malloc((groups.mask + 1) * sizeof(int));
+    groups.pool = group_pool;
+    ok = ok && groups.slots != NULL && group_pool != NULL && group_of_slot != NULL;
+    for (size_t i = 0; ok && i <= groups.mask; i++) group_of_slot[i] = -1;
+
+    const char* p = data;
+    int line_no = 0;
+    while (ok && p < end) {
+        const char* line_end = memchr(p, '\n', end - p);
+        if (line_end == NULL) line_end = end;
+        line_no++;
+
+        long release_ms = 0;
+        int core;
+        while (p < line_end && is_space(*p)) p++;
+        if (p < line_end && *p == '@') {
+            // Timed line: @ms core tasks... or @ms * tasks...
+            p++;
+            release_ms = scan_number(&p, line_end);
+            while (p < line_end && is_space(*p)) p++;
+            long c = RELEASE_ANY_CORE;
+            if (p < line_end && *p == '*') {
+                p++;
+            } else {
+                c = scan_number(&p, line_end);
+                if (c < 0) c = NUM_CORES;
+            }
+            if (release_ms < 0 || c >= NUM_CORES) {
+                fprintf(stderr, "%s:%d: expected '@ms core' with core below %d or '*'\n",
+                        filename, line_no, NUM_CORES);
+                ok = 0;
+                break;
+            }
+            core = (int) c;
+        } else {
+            // Plain line: initial queue of the next core, wrapping after NUM_CORES lines
+            core = set->num_cores_used % NUM_CORES;
+            set->num_cores_used++;
+        }
+
+        while (p < line_end) {
+            while (p < line_end && is_space(*p)) p++;
+            const char* token = p;
+            while (p < line_end && !is_space(*p)) p++;
+            const char* token_end = p;
+            if (token == token_end) continue;
+
+            // Optional #group suffix ends the rest of the token
+            const char* group_name = memchr(token, '#', token_end - token);
+            const char* group_end = token_end;
+            if (group_name != NULL) {
+                token_end = group_name;
+                group_name++;
+            }
+
+            // ID-dur, the id runs up to the first '-' and the duration up to
+            // the predecessor list
+            const char* dash = token;
+            while (dash < token_end && *dash != '-') dash++;
+            const char* num = dash + 1;
+            long duration = dash < token_end ? scan_number(&num, token_end) : -1;
+            if (dash == token || duration < 0 || duration > INT_MAX || (num < token_end && *num != ':')) {
+                fprintf(stderr, "%s:%d: expected ID-dur, got '%.*s'\n", filename, line_no,
+                        (int) (group_end - token), token);
+                ok = 0;
+                break;
+            }
+
+            Task* task = &set->tasks[set->num_tasks];
+            size_t slot = intern(&table, token, dash - token);
+            if (table.owners[slot] != NULL) {
+                fprintf(stderr, "%s:%d: duplicate task id %s\n", filename, line_no, table.slots[slot]);
+                ok = 0;
+                break;
+            }
+            table.owners[slot] = task;
+            task -> task_id = table.slots[slot];
+            task -> task_duration = (int) duration;
+            task -> cache_warmed_up = 1.0;
+            task -> owner = NULL;
+            task -> level = 0;
+            task -> level_cycles = 0;
+            task -> quantum = 1;
+            task -> release_ms = release_ms;
+            task -> finish_ms = 0;
+            task -> successors = NULL;
+            task -> num_successors = 0;
+            task -> critical_ms = 0;
+            task -> working_set = NULL;
+
+            // Group of the id without trailing digits unless tagged
+            if (group_name == NULL || group_name == group_end) {
+                group_name = token;
+                group_end = dash;
+                while (group_end > group_name + 1 && group_end[-1] >= '0' && group_end[-1] <= '9') group_end--;
+            }
+            size_t group_slot = intern(&groups, group_name, group_end - group_name);
+            if (group_of_slot[group_slot] < 0) group_of_slot[group_slot] = set->num_groups++;
+            task -> group = group_of_slot[group_slot];
+
+            // Optional :P1,P2 predecessor list
+            int num_preds = 0;
+            if (num < token_end && *num == ':') {
+                const char* pred = num + 1;
+                while (pred < token_end) {
+                    const char* pred_end = pred;
+                    while (pred_end < token_end && *pred_end != ',') pred_end++;
+                    if (pred_end > pred) {
+                        edges[set->num_edges].task = task;
+                        edges[set->num_edges].pred_slot = intern(&table, pred, pred_end - pred);
+                        set->num_edges++;
+                        num_preds++;
+                    }
+                    pred = pred_end + 1;
+                }
+            }
+            // The release itself counts as one more predecessor
+            atomic_init(&task -> pending_preds, num_preds + 1);
+
+            TaskRelease* r = &set->releases[set->num_tasks];
+            r->release_ms = release_ms;
+            r->core = core;
+            r->task = task;
+            set->num_tasks++;
+        }
+        p = line_end + 1;
+    }
+
+    if (ok && link_tasks(filename, set, &table, edges) != 0) ok = 0;
+
+    free(groups.slots);
+    free(group_of_slot);
+    free(group_pool);
+    free(table.slots);
+    free(table.owners);
+    free(edges);
+    if (data != NULL) munmap((void*) data, size);
+    if (!ok) {
+        free_tasks(set);
+        return -1;
+    }
+
+    qsort(set->releases, set->num_tasks, sizeof(TaskRelease), compare_release);
+    return 0;
+}
+
+void free_tasks(TaskSet* set) {
+    free(set->tasks);
+    free(set->releases);
+    free(set->order);
+    free(set->successors);
+    free(set->ids);
+    memset(set, 0, sizeof(*set));
+}
@@ -0,0 +1,48 @@
+#ifndef TASK_LOADER_H
+#define TASK_LOADER_H
+
+#include "wbq.h"
+
+// Task file loader. The file is mapped into memory and scanned in place,
+// tasks are carved out of one arena and identical task ids share a single
+// interned string, so there is no per-task allocation and no line limit.
+//
+// Format, one entry per line:
+//   ID-dur ID-dur ...              initial queue of the next core
+//   @ms core ID-dur ID-dur ...     tasks released on core at time ms
+//   @ms * ID-dur ID-dur ...        tasks released into the global injection queue
+// Plain lines are assigned to cores in order, timed lines don't take a core.
+// A task written as ID-dur:P1,P2 only becomes runnable once the tasks with
+// ids P1 and P2 finished, predecessors are looked up by id and may appear
+// anywhere in the file. Task ids must be unique.
+// Tasks belong to the group named by an optional #group suffix, as in
+// ID-dur:P1#group, or else to the group of their id without the trailing
+// digits, so ATask1 and ATask7 share group ATask.
+
+#define RELEASE_ANY_CORE -1
+
+typedef struct TaskRelease {
+    long release_ms;        // Simulated time the task becomes available, 0 for initial tasks
+    int core;               // Core whose queue receives the task, or RELEASE_ANY_CORE
+    Task* task;
+} TaskRelease;
+
+typedef struct TaskSet {
+    Task* tasks;            // Task arena, in file order
+    int num_tasks;
+    TaskRelease* releases;  // One entry per task, sorted by release time
+    Task** order;           // Tasks in topological order of the dependency graph
+    Task** successors;      // Successor lists of all tasks
+    int num_edges;
+    int num_cores_used;     // Number of plain lines read
+    int num_groups;         // Task groups, Task group indexes run below this
+    char* ids;              // Interned id strings
+} TaskSet;
+
+// Load filename into set, returns 0 on success and -1 on error.
+// Malformed tasks and @ms core headers, duplicate ids, unknown predecessors
+// and dependency cycles are errors and reported on stderr.
+int load_tasks(const char* filename, TaskSet* set);
+void free_tasks(TaskSet* set);
+
+#endif
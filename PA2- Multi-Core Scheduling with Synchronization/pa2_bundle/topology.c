@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "topology.h"
+
+Topology topology;
+
+static const char* distance_names[TOPO_LEVELS] = { "smt", "llc", "socket", "remote" };
+
+// Read one integer from a sysfs file, returns fallback if it is missing
+static int read_sys_int(int cpu, const char* path, int fallback) {
+    char name[128];
+    snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu%d/%s", cpu, path);
+    FILE* file = fopen(name, "r");
+    if (file == NULL) return fallback;
+    int value;
+    if (fscanf(file, "%d", &value) != 1) value = fallback;
+    fclose(file);
+    return value;
+}
+
+// Id of the highest level cache of cpu, -1 if sysfs has no cache info
+static int read_llc_id(int cpu) {
+    int best_level = 0, best_id = -1;
+    for (int index = 0; index < 8; index++) {
+        char path[64];
+        snprintf(path, sizeof(path), "cache/index%d/level", index);
+        int level = read_sys_int(cpu, path, -1);
+        if (level < 0) break;
+        snprintf(path, sizeof(path), "cache/index%d/id", index);
+        int id = read_sys_int(cpu, path, -1);
+        if (level > best_level && id >= 0) {
+            best_level = level;
+            best_id = id;
+        }
+    }
+    return best_id;
+}
+
+static int load_sysfs() {
+    // Only use cpus this process may run on, wrapping if there are fewer than cores
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return -1;
+    int cpus[CPU_SETSIZE];
+    int num_cpus = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) cpus[num_cpus++] = cpu;
+    }
+    if (num_cpus == 0) return -1;
+
+    for (int i = 0; i < NUM_CORES; i++) {
+        CpuPlace* place = &topology.places[i];
+        place->cpu = cpus[i % num_cpus];
+        place->socket = read_sys_int(place->cpu, "topology/physical_package_id", 0);
+        place->core = read_sys_int(place->cpu, "topology/core_id", place->cpu);
+        place->llc = read_llc_id(place->cpu);
+        // Without cache info the socket is the best guess for the shared cache
+        if (place->llc < 0) place->llc = place->socket;
+    }
+    return 0;
+}
+
+static int load_file(const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) return -1;
+
+    char line[256];
+    int num_places = 0;
+    while (num_places < NUM_CORES && fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        CpuPlace* place = &topology.places[num_places];
+        if (sscanf(line, "%d %d %d %d", &place->cpu, &place->socket, &place->llc, &place->core) != 4) {
+            fprintf(stderr, "%s: expected 'cpu socket llc core', got %s", filename, line);
+            fclose(file);
+            return -1;
+        }
+        num_places++;
+    }
+    fclose(file);
+
+    if (num_places < NUM_CORES) {
+        fprintf(stderr, "%s: %d cores described, need %d\n", filename, num_places, NUM_CORES);
+        return -1;
+    }
+    return 0;
+}
+
+static TopologyDistance place_distance(const CpuPlace* a, const CpuPlace* b) {
+    if (a->socket != b->socket) return TOPO_REMOTE;
+    if (a->cpu == b->cpu || a->core == b->core) return TOPO_SMT;
+    if (a->llc == b->llc) return TOPO_LLC;
+    return TOPO_SOCKET;
+}
+
+void topology_init_flat() {
+    memset(&topology, 0, sizeof(topology));
+    for (int i = 0; i < NUM_CORES; i++) {
+        int n = 0;
+        for (int j = 0; j < NUM_CORES; j++) {
+            topology.distance[i][j] = TOPO_LLC;
+            if (j != i) topology.steal_order[i][n++] = j;
+        }
+        topology.distance[i][i] = TOPO_SMT;
+    }
+}
+
+int topology_load(const char* filename) {
+    topology_init_flat();
+    int rc = strcmp(filename, "sys") == 0 ? load_sysfs() : load_file(filename);
+    if (rc != 0) return -1;
+
+    for (int i = 0; i < NUM_CORES; i++) {
+        for (int j = 0; j < NUM_CORES; j++) {
+            topology.distance[i][j] = place_distance(&topology.places[i], &topology.places[j]);
+        }
+
+        // Stable insertion sort of the flat order by distance, ties stay in index order
+        int* order = topology.steal_order[i];
+        for (int k = 1; k < NUM_CORES - 1; k++) {
+            int core = order[k];
+            int m = k;
+            while (m > 0 && topology.distance[i][order[m - 1]] > topology.distance[i][core]) {
+                order[m] = order[m - 1];
+                m--;
+            }
+            order[m] = core;
+        }
+    }
+    topology.loaded = 1;
+    return 0;
+}
+
+void topology_pin(pthread_attr_t* attr, int my_id) {
+    if (!topology.loaded) return;
+
+    // Cpus of a description file may not exist here, leave those threads unpinned
+    cpu_set_t allowed;
+    int cpu = topology.places[my_id].cpu;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || cpu < 0 || cpu >= CPU_SETSIZE ||
+        !CPU_ISSET(cpu, &allowed)) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+const char* topology_distance_name(TopologyDistance distance) {
+    return distance_names[distance];
+}
@@ -0,0 +1,55 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <pthread.h>
+#include "constants.h"
+
+// CPU topology the simulated cores are mapped onto. Every simulated core is
+// pinned to one real CPU and gets a steal order that visits the other cores
+// from the nearest cache domain outwards, so stolen tasks move as short a
+// distance as possible.
+//
+// The topology is read from /sys/devices/system/cpu, or from a description
+// file with one line per simulated core, in core order:
+//   cpu socket llc core
+// where llc and core are ids of the last level cache and of the physical
+// core the cpu belongs to. Lines starting with '#' are comments.
+
+// Distance between two simulated cores, nearest first
+typedef enum TopologyDistance {
+    TOPO_SMT,           // Same physical core, hyperthread siblings or the same cpu
+    TOPO_LLC,           // Shared last level cache
+    TOPO_SOCKET,        // Same socket, different last level cache
+    TOPO_REMOTE,        // Different socket
+    TOPO_LEVELS
+} TopologyDistance;
+
+typedef struct CpuPlace {
+    int cpu;
+    int socket;
+    int llc;
+    int core;
+} CpuPlace;
+
+typedef struct Topology {
+    int loaded;                                     // 0 keeps the flat index order
+    CpuPlace places[NUM_CORES];
+    int steal_order[NUM_CORES][NUM_CORES - 1];      // Other cores, nearest first
+    TopologyDistance distance[NUM_CORES][NUM_CORES];
+} Topology;
+
+extern Topology topology;
+
+// Fill the steal order in plain index order, used without a topology.
+void topology_init_flat();
+
+// Load the topology from a description file, or from sysfs if filename is
+// "sys". Returns 0 on success and -1 on error.
+int topology_load(const char* filename);
+
+// Pin the thread created with attr to the cpu of simulated core my_id.
+void topology_pin(pthread_attr_t* attr, int my_id);
+
+const char* topology_distance_name(TopologyDistance distance);
+
+#endif
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "sim_trace.h"
+
+// Offline viewer for the traces written by sim -r. Prints either a Chrome
+// trace event JSON file, which chrome://tracing and ui.perfetto.dev open
+// directly, or an ASCII Gantt chart with one row per core.
+
+typedef struct Trace {
+    TraceHeader header;
+    char** ids;
+    TraceEvent* events;
+    size_t num_events;
+    uint64_t end_us;
+} Trace;
+
+static int read_trace(const char* filename, Trace* trace) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        perror(filename);
+        return -1;
+    }
+    if (fread(&trace->header, sizeof(trace->header), 1, file) != 1 ||
+        memcmp(trace->header.magic, TRACE_MAGIC, sizeof(trace->header.magic)) != 0 ||
+        trace->header.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a version %d scheduling trace\n", filename, TRACE_VERSION);
+        fclose(file);
+        return -1;
+    }
+
+    trace->ids = calloc(trace->header.num_tasks + 1, sizeof(char*));
+    for (uint32_t i = 0; i < trace->header.num_tasks; i++) {
+        uint16_t length;
+        if (fread(&length, sizeof(length), 1, file) != 1) break;
+        trace->ids[i] = calloc(length + 1, 1);
+        if (fread(trace->ids[i], 1, length, file) != length) break;
+    }
+
+    size_t capacity = 1024;
+    trace->events = malloc(capacity * sizeof(TraceEvent));
+    trace->num_events = 0;
+    trace->end_us = 0;
+    TraceEvent e;
+    while (fread(&e, sizeof(e), 1, file) == 1) {
+        if (e.core < 0 || (uint32_t) e.core >= trace->header.num_cores) continue;
+        if (e.task < TRACE_NO_TASK || e.task >= (int32_t) trace->header.num_tasks) continue;
+        if (trace->num_events == capacity) {
+            capacity *= 2;
+            trace->events = realloc(trace->events, capacity * sizeof(TraceEvent));
+        }
+        trace->events[trace->num_events++] = e;
+        if (e.time_us > trace->end_us) trace->end_us = e.time_us;
+    }
+    fclose(file);
+    return 0;
+}
+
+static const char* task_name(const Trace* trace, int32_t task) {
+    // TRACE_NO_TASK and anything else below 0 has no name
+    if (task < 0 || trace->ids[task] == NULL) return "";
+    return trace->ids[task];
+}
+
+// Task ids come from the generator, print them as they are but keep the JSON valid
+static void print_json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        if ((unsigned char) *s >= 0x20) fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void write_json(const Trace* trace, FILE* out) {
+    uint64_t* slice_start = calloc(trace->header.num_cores, sizeof(uint64_t));
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (uint32_t core = 0; core < trace->header.num_cores; core++) {
+        fprintf(out, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"Core %u\"}},\n",
+                core, core);
+    }
+
+    for (size_t i = 0; i < trace->num_events; i++) {
+        const TraceEvent* e = &trace->events[i];
+        switch (e->type) {
+        case TRACE_SLICE_START:
+            slice_start[e->core] = e->time_us;
+            break;
+        case TRACE_SLICE_END:
+            fprintf(out, "{\"ph\":\"X\",\"name\":");
+            print_json_string(out, task_name(trace, e->task));
+            fprintf(out, ",\"pid\":0,\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"args\":{\"remaining_ms\":%d}},\n",
+                    e->core, (unsigned long long) slice_start[e->core],
+                    (unsigned long long) (e->time_us - slice_start[e->core]), e->value);
+            break;
+        case TRACE_IDLE:
+            fprintf(out, "{\"ph\":\"X\",\"name\":\"idle\",\"cat\":\"idle\",\"pid\":0,\"tid\":%d,\"ts\":%llu,\"dur\":%d},\n",
+                    e->core, (unsigned long long) e->time_us, e->value);
+            break;
+        default: {
+            static const char* names[] = { "", "", "steal", "push", "", "resubmit", "release", "injected", "park", "unpark" };
+            fprintf(out, "{\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\",\"pid\":0,\"tid\":%d,\"ts\":%llu,\"args\":{\"task\":",
+                    e->type < sizeof(names) / sizeof(*names) ? names[e->type] : "event", e->core,
+                    (unsigned long long) e->time_us);
+            print_json_string(out, task_name(trace, e->task));
+            fprintf(out, ",\"other_core\":%d,\"value\":%d}},\n", e->other, e->value);
+        }
+        }
+    }
+    // Closing event so the list needs no trailing comma handling
+    fprintf(out, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":0,\"args\":{\"name\":\"wbq simulator\"}}\n]}\n");
+    free(slice_start);
+}
+
+// One character per time column: the first letter of the task that ran
+// most of the column, '.' when the core was idle for most of it
+static void write_gantt(const Trace* trace, FILE* out, int width) {
+    uint32_t cores = trace->header.num_cores;
+    double column_us = trace->end_us > 0 ? (double) trace->end_us / width : 1;
+    double* busy = calloc((size_t) cores * width, sizeof(double));
+    double* best = calloc((size_t) cores * width, sizeof(double));
+    int32_t* owner = malloc((size_t) cores * width * sizeof(int32_t));
+    uint64_t* slice_start = calloc(cores, sizeof(uint64_t));
+    long* steals = calloc((size_t) cores * cores, sizeof(long));
+    long* idles = calloc(cores, sizeof(long));
+
+    for (size_t i = 0; i < trace->num_events; i++) {
+        const TraceEvent* e = &trace->events[i];
+        if (e->type == TRACE_SLICE_START) {
+            slice_start[e->core] = e->time_us;
+        } else if (e->type == TRACE_SLICE_END) {
+            // Spread the slice over the columns it overlaps
+            double from = slice_start[e->core], to = e->time_us;
+            for (int col = from / column_us; col < width && col * column_us < to; col++) {
+                double lo = col * column_us > from ? col * column_us : from;
+                double hi = (col + 1) * column_us < to ? (col + 1) * column_us : to;
+                size_t cell = (size_t) e->core * width + col;
+                busy[cell] += hi - lo;
+                if (hi - lo > best[cell]) {
+                    best[cell] = hi - lo;
+                    owner[cell] = e->task;
+                }
+            }
+        } else if (e->type == TRACE_STEAL && e->other >= 0 && (uint32_t) e->other < cores) {
+            steals[(size_t) e->core * cores + e->other]++;
+        } else if (e->type == TRACE_IDLE) {
+            idles[e->core]++;
+        }
+    }
+
+    fprintf(out, "%.0f ms, %.1f ms per column, letters are the first character of the task id, '.' is idle\n",
+            trace->end_us / 1000.0, column_us / 1000.0);
+    for (uint32_t core = 0; core < cores; core++) {
+        double total = 0;
+        fprintf(out, "Core %u |", core);
+        for (int col = 0; col < width; col++) {
+            size_t cell = (size_t) core * width + col;
+            total += busy[cell];
+            char c = '.';
+            if (busy[cell] >= column_us / 2) {
+                const char* name = task_name(trace, owner[cell]);
+                c = isalnum((unsigned char) name[0]) ? name[0] : '#';
+            }
+            fputc(c, out);
+        }
+        fprintf(out, "| busy %3.0f%%, idle polls %ld\n", trace->end_us > 0 ? 100.0 * total / trace->end_us : 0.0,
+                idles[core]);
+    }
+
+    fprintf(out, "Steals, thief row from victim column:\n      ");
+    for (uint32_t victim = 0; victim < cores; victim++) fprintf(out, "%5u", victim);
+    fprintf(out, "\n");
+    for (uint32_t thief = 0; thief < cores; thief++) {
+        fprintf(out, "Core %u", thief);
+        for (uint32_t victim = 0; victim < cores; victim++) {
+            fprintf(out, "%5ld", steals[(size_t) thief * cores + victim]);
+        }
+        fprintf(out, "\n");
+    }
+
+    free(busy);
+    free(best);
+    free(owner);
+    free(slice_start);
+    free(steals);
+    free(idles);
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-f json|gantt] [-w width] [-o file] trace.bin\n", prog);
+    fprintf(stderr, "  -f <format>  json for chrome://tracing and Perfetto, or gantt (default)\n");
+    fprintf(stderr, "  -w <width>   columns of the Gantt chart (default 100)\n");
+    fprintf(stderr, "  -o <file>    output file (default stdout)\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* format = "gantt";
+    const char* output = NULL;
+    int width = 100;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:w:o:")) != -1) {
+        switch (opt) {
+        case 'f': format = optarg; break;
+        case 'w': width = atoi(optarg); break;
+        case 'o': output = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || width <= 0 || (strcmp(format, "json") != 0 && strcmp(format, "gantt") != 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Trace trace;
+    if (read_trace(argv[optind], &trace) != 0) return 1;
+
+    FILE* out = output != NULL ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        perror(output);
+        return 1;
+    }
+    if (strcmp(format, "json") == 0) {
+        write_json(&trace, out);
+    } else {
+        write_gantt(&trace, out, width);
+    }
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -1,101 +1,516 @@
-#include <stdio.h>
-#include <stdlib.h> 
-#include <string.h>
-#include <pthread.h>
-#include <unistd.h>
-#include <time.h>
-#include <limits.h>
-#include "constants.h"
-#include "wbq.h"
-
-extern int stop_threads;
-extern int finished_jobs[NUM_CORES];
-extern WorkBalancerQueue** processor_queues;
-
-// thread function for each core simulator thread
-void* processJobs(void* arg) {
-    // initialize local variables
-    ThreadArguments* my_arg = (ThreadArguments*) arg;
-    WorkBalancerQueue* my_queue = my_arg->q;
-    int my_id = my_arg->id;
-    free(my_arg);  // free allocated argument
-
-    // load balancing thresholds
-    int LOW_WATERMARK = 10;
-    int HIGH_WATERMARK = 20;
-
-    while (!stop_threads) {
-        // fetch task from own queue
-        Task* task = fetchTask(my_queue);
-
-        if (task == NULL) {
-            // queue is empty | below low watermark
-            // attempt fetch tasks from other cores
-            int fetched = 0;
-
-            // check own queue size
-            pthread_mutex_lock(&(my_queue->mutex));
-            int my_queue_size = my_queue->size;
-            pthread_mutex_unlock(&(my_queue->mutex));
-
-            if (my_queue_size < LOW_WATERMARK) {
-                for (int i = 0; i < NUM_CORES; i++) {
-                    if (i == my_id) continue; // skip own queue
-
-                    // check if other queue is over high watermark
-                    WorkBalancerQueue* other_queue = processor_queues[i];
-
-                    // lock other queue to read its size
-                    pthread_mutex_lock(&(other_queue->mutex));
-                    int other_queue_size = other_queue->size;
-                    pthread_mutex_unlock(&(other_queue->mutex));
-
-                    if (other_queue_size > HIGH_WATERMARK) {
-                        // try stealing    task
-                        Task* stolen_task = fetchTaskFromOthers(other_queue);
-                        if (stolen_task != NULL) {
-                            task = stolen_task;
-                            // reset cache_warmed_up, task is migrated
-                            task->cache_warmed_up = 1.0;
-                            // update task owner
-                            task->owner = my_queue;
-                            fetched = 1;
-                            break;
-                        }
-                    }
-                }
-            }
-
-            if (!fetched) {
-                // no tasks to fetch,core can sleep 
-                usleep(1000); // sleep for 1 ms
-                continue;
-            }
-        }
-
-        // execute task
-        executeJob(task, my_queue, my_id);
-
-        // check if task finished
-        if (task->task_duration > 0) {
-            // submit task back to own queue
-            submitTask(my_queue, task);
-        } else {
-            // task is finished, free task
-            free(task->task_id);
-            free(task);
-        }
-    }
-
-    pthread_exit(NULL);
-}
-
-// initialize shared vars and mutexes
-void initSharedVariables() {
-    for (int i = 0; i < NUM_CORES; i++) {
-        pthread_mutex_init(&(processor_queues[i]->mutex), NULL);
-        processor_queues[i]->head = NULL;
-        processor_queues[i]->tail = NULL;
-        processor_queues[i]->size = 0;
-    }
-}
+#include <stdio.h>
+#include <stdlib.h> 
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include "constants.h"
+#include "wbq.h"
+#include "sim_config.h"
+#include "sim_stats.h"
+#include "topology.h"
+#include "sim_trace.h"
+
+extern int stop_threads;
+extern int finished_jobs[NUM_CORES];
+extern WorkBalancerQueue** processor_queues;
+extern InjectionQueue injection_queue;
+extern int num_groups;
+
+// steal policy selected in initSharedVariables
+StealPolicy stealTask = fetchTaskFromOthers;
+
+// load balancing thresholds of each core, only touched by the owner
+Watermarks watermarks[NUM_CORES];
+
+// elastic mode, parked flags and active count change under park_mutex,
+// the flags are atomic so pushes can skip parked cores without the lock
+pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+atomic_int parked[NUM_CORES];
+int active_cores = NUM_CORES;
+// gang mode, tasks of each group running now and the group owning the window
+atomic_int* group_running;
+atomic_int gang_group;
+atomic_long gang_window_end_ms;
+
+// queued plus running work and tasks of each core, only written by the owner
+atomic_int core_load[NUM_CORES];
+atomic_int core_tasks[NUM_CORES];
+
+// cycles task runs before it goes back through the queue
+int taskQuantum(Task* task) {
+    if (sim_config.quantum_cycles > 0) return sim_config.quantum_cycles;
+
+    // short remainder runs to completion instead of another dispatch
+    long remaining = cycles_to_finish(task->task_duration, task->cache_warmed_up);
+    if (remaining <= task->quantum + QUANTUM_FINISH_SLACK) return remaining;
+    return task->quantum;
+}
+
+// tune watermarks of a core from a sample of its own queue
+void updateWatermarks(Watermarks* wm, int len, int work) {
+    // track queue length and work distribution
+    wm->avg_len += WATERMARK_EWMA * (len - wm->avg_len);
+    wm->avg_work += WATERMARK_EWMA * (work - wm->avg_work);
+
+    // look for work before running dry, half of the usual backlog
+    wm->low = wm->avg_work / 2;
+    if (wm->low < CYCLE) wm->low = CYCLE;
+    wm->low_len = wm->avg_len / 2;
+    if (wm->low_len < 1) wm->low_len = 1;
+
+    // victims must hold clearly more than we consider low
+    if (wm->high < 2 * wm->low) wm->high = 2 * wm->low;
+}
+
+// try to steal one task from a core over the high watermark
+Task* stealFromOthers(int my_id, WorkBalancerQueue* my_queue) {
+    Watermarks* wm = &watermarks[my_id];
+    int saw_work = 0;
+
+    // visit other cores nearest cache domain first
+    for (int k = 0; k < NUM_CORES - 1; k++) {
+        int i = topology.steal_order[my_id][k];
+
+        // check if other queue is over high watermark
+        WorkBalancerQueue* other_queue = processor_queues[i];
+
+        // lock other queue to read its work
+        pthread_mutex_lock(&(other_queue->mutex));
+        int other_queue_work = other_queue->work;
+        pthread_mutex_unlock(&(other_queue->mutex));
+
+        if (other_queue_work > 0) saw_work = 1;
+
+        if (other_queue_work > wm->high) {
+            // try stealing    task
+            Task* task = stealTask(other_queue);
+            if (task != NULL) {
+                // reset cache_warmed_up, task is migrated
+                // cross socket steals start below cold
+                TopologyDistance distance = topology.distance[my_id][i];
+                task->cache_warmed_up = distance == TOPO_REMOTE ? REMOTE_CACHE_FACTOR : 1.0;
+                // update task owner
+                task->owner = my_queue;
+                // count steal for run summary
+                sim_stats.steals[my_id]++;
+                sim_stats.steal_distance[my_id][distance]++;
+                sim_trace(my_id, TRACE_STEAL, task, i, 0);
+
+                // successful steals let the core be pickier
+                wm->steal_success += WATERMARK_EWMA * (1 - wm->steal_success);
+                if (wm->steal_success > 0.75 && wm->high < 4 * HIGH_WATERMARK * CYCLE) wm->high *= 1.05;
+                return task;
+            }
+        }
+    }
+
+    // failed while others had work, the high watermark is too strict
+    wm->steal_success -= WATERMARK_EWMA * wm->steal_success;
+    if (saw_work) {
+        wm->high *= wm->steal_success < 0.25 ? 0.7 : 0.9;
+        if (wm->high < CYCLE) wm->high = CYCLE;
+    }
+    return NULL;
+}
+
+// hand tasks from an overloaded queue to the least loaded core
+void pushToOthers(int my_id, WorkBalancerQueue* my_queue) {
+    for (int pushed = 0; pushed < PUSH_BATCH; pushed++) {
+        // check own work against push watermark
+        pthread_mutex_lock(&(my_queue->mutex));
+        int my_queue_work = my_queue->work;
+        int my_queue_size = my_queue->size;
+        pthread_mutex_unlock(&(my_queue->mutex));
+        if (my_queue_work <= PUSH_WATERMARK * CYCLE || my_queue_size < 2) return;
+
+        // find least loaded core
+        int target = -1;
+        int target_work = INT_MAX;
+        for (int i = 0; i < NUM_CORES; i++) {
+            if (i == my_id || atomic_load(&parked[i])) continue; // skip own queue and parked cores
+
+            pthread_mutex_lock(&(processor_queues[i]->mutex));
+            int other_queue_work = processor_queues[i]->work;
+            pthread_mutex_unlock(&(processor_queues[i]->mutex));
+
+            if (other_queue_work < target_work) {
+                target = i;
+                target_work = other_queue_work;
+            }
+        }
+
+        // only push when it narrows the gap
+        if (target < 0 || 2 * target_work >= my_queue_work) return;
+
+        // steal policy picks the task to give away
+        Task* task = stealTask(my_queue);
+        if (task == NULL) return;
+        submitTask(processor_queues[target], task);
+        sim_trace(my_id, TRACE_PUSH, task, target, 0);
+        // count push for run summary
+        sim_stats.pushes[my_id]++;
+    }
+}
+
+// hand own tasks to target and sleep until woken or own queue gets work,
+// total_load is the work of all cores including the tasks handed over
+void parkCore(int my_id, WorkBalancerQueue* my_queue, int target, long total_load) {
+    // move slot and queued tasks to target core
+    WorkBalancerQueue* target_queue = processor_queues[target];
+    if (my_queue->next != NULL) {
+        submitTask(target_queue, my_queue->next);
+        my_queue->next = NULL;
+    }
+    Task* task;
+    while ((task = fetchTask(my_queue)) != NULL) {
+        submitTask(target_queue, task);
+    }
+    atomic_store(&core_load[my_id], 0);
+    atomic_store(&core_tasks[my_id], 0);
+    sim_trace(my_id, TRACE_PARK, NULL, target, (int) total_load);
+
+    long park_start_ms = sim_time_ms();
+    pthread_mutex_lock(&park_mutex);
+    while (atomic_load(&parked[my_id]) && !stop_threads) {
+        // wait for wake up, poll own and injection queue for released tasks meanwhile
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        long wait_ns = deadline.tv_nsec + (long) (PARK_POLL_MS * 1000000 / sim_config.time_scale);
+        deadline.tv_sec += wait_ns / 1000000000;
+        deadline.tv_nsec = wait_ns % 1000000000;
+        pthread_cond_timedwait(&park_cond, &park_mutex, &deadline);
+
+        pthread_mutex_lock(&(my_queue->mutex));
+        int my_queue_size = my_queue->size;
+        pthread_mutex_unlock(&(my_queue->mutex));
+        if (atomic_load(&parked[my_id]) && (my_queue_size > 0 || injectedTasks(&injection_queue) > 0)) {
+            atomic_store(&parked[my_id], 0);
+            active_cores++;
+        }
+    }
+    pthread_mutex_unlock(&park_mutex);
+
+    // count parked time for run summary
+    if (stop_threads) {
+        sim_stats.parked_at_exit[my_id] = 1;
+        sim_stats.exit_park_start_ms[my_id] = park_start_ms;
+    } else {
+        sim_stats.parked_ms[my_id] += sim_time_ms() - park_start_ms;
+        sim_trace(my_id, TRACE_UNPARK, NULL, -1, 0);
+    }
+}
+
+// elastic mode: park this core or wake a parked one depending on total load
+// called between dispatches, so the running task is back in queue or slot
+void balanceCores(int my_id, WorkBalancerQueue* my_queue) {
+    // publish own load, queue plus slot
+    pthread_mutex_lock(&(my_queue->mutex));
+    int load = my_queue->work;
+    int tasks = my_queue->size;
+    pthread_mutex_unlock(&(my_queue->mutex));
+    if (my_queue->next != NULL) {
+        load += my_queue->next->task_duration;
+        tasks++;
+    }
+    atomic_store(&core_load[my_id], load);
+    atomic_store(&core_tasks[my_id], tasks);
+
+    long total_load = 0;
+    int total_tasks = 0;
+    for (int i = 0; i < NUM_CORES; i++) {
+        total_load += atomic_load(&core_load[i]);
+        total_tasks += atomic_load(&core_tasks[i]);
+    }
+
+    pthread_mutex_lock(&park_mutex);
+    if (active_cores < NUM_CORES &&
+        (total_load > (long) active_cores * UNPARK_WORK * CYCLE || total_tasks > active_cores + 1)) {
+        // load or tasks pile up, wake lowest parked core
+        for (int i = 0; i < NUM_CORES; i++) {
+            if (atomic_load(&parked[i])) {
+                atomic_store(&parked[i], 0);
+                active_cores++;
+                pthread_cond_broadcast(&park_cond);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&park_mutex);
+        return;
+    }
+
+    // only least loaded active core parks, so cores leave one by one,
+    // idle ones first and highest id on ties, core 0 stays
+    int park_candidate = 0;
+    int park_candidate_load = INT_MAX;
+    for (int i = 1; i < NUM_CORES; i++) {
+        int load_i = atomic_load(&core_load[i]);
+        if (!atomic_load(&parked[i]) && load_i <= park_candidate_load) {
+            park_candidate = i;
+            park_candidate_load = load_i;
+        }
+    }
+    // parking while every core has a task would only time share them
+    if (my_id != 0 && my_id == park_candidate && total_tasks < active_cores &&
+        total_load < (long) (active_cores - 1) * PARK_WORK * CYCLE) {
+        // nearest active core without tasks takes over own tasks, else nearest active
+        int target = -1;
+        for (int k = 0; k < NUM_CORES - 1; k++) {
+            int i = topology.steal_order[my_id][k];
+            if (atomic_load(&parked[i])) continue;
+            if (target < 0) target = i;
+            if (atomic_load(&core_tasks[i]) == 0) {
+                target = i;
+                break;
+            }
+        }
+        atomic_store(&parked[my_id], 1);
+        active_cores--;
+        pthread_mutex_unlock(&park_mutex);
+        parkCore(my_id, my_queue, target, total_load);
+        return;
+    }
+    pthread_mutex_unlock(&park_mutex);
+}
+
+// gang mode: run tasks of the window's group on as many cores as possible
+Task* fetchGangTask(int my_id, WorkBalancerQueue* my_queue) {
+    // window over, group at head of own queue gets the next one
+    long now_ms = sim_time_ms();
+    long window_end_ms = atomic_load(&gang_window_end_ms);
+    if (now_ms >= window_end_ms) {
+        pthread_mutex_lock(&(my_queue->mutex));
+        int head_group = my_queue->head != NULL ? my_queue->head->task->group : -1;
+        pthread_mutex_unlock(&(my_queue->mutex));
+
+        // only one core opens the window
+        if (head_group >= 0 && atomic_compare_exchange_strong(&gang_window_end_ms, &window_end_ms,
+                                                              now_ms + GANG_WINDOW * CYCLE)) {
+            atomic_store(&gang_group, head_group);
+        }
+    }
+    int group = atomic_load(&gang_group);
+
+    // own task of gang group first
+    Task* task = fetchTaskOfGroup(my_queue, group);
+    if (task != NULL) return task;
+
+    // then pull gang task from other cores, nearest first
+    for (int k = 0; k < NUM_CORES - 1; k++) {
+        int i = topology.steal_order[my_id][k];
+        task = fetchTaskOfGroup(processor_queues[i], group);
+        if (task != NULL) {
+            // task is migrated like a steal
+            task->cache_warmed_up = 1.0;
+            task->owner = my_queue;
+            sim_stats.gang_pulls[my_id]++;
+            sim_trace(my_id, TRACE_STEAL, task, i, 0);
+            return task;
+        }
+    }
+
+    // no gang task left anywhere, keep core busy with own work
+    return fetchTask(my_queue);
+}
+
+// thread function for each core simulator thread
+void* processJobs(void* arg) {
+    // initialize local variables
+    ThreadArguments* my_arg = (ThreadArguments*) arg;
+    WorkBalancerQueue* my_queue = my_arg->q;
+    int my_id = my_arg->id;
+    free(my_arg);  // free allocated argument
+
+    Watermarks* wm = &watermarks[my_id];
+    int cycles_since_boost = 0;
+
+    while (!stop_threads) {
+        // run task from next slot first, else fetch from own queue
+        Task* task = my_queue->next;
+        if (task != NULL) {
+            my_queue->next = NULL;
+            sim_stats.slot_hits[my_id]++;
+        } else if (sim_config.gang_mode == GANG_SCHEDULE) {
+            task = fetchGangTask(my_id, my_queue);
+        } else {
+            task = fetchTask(my_queue);
+        }
+
+        // idle core drains injection queue before stealing
+        if (task == NULL) {
+            task = fetchInjectedTask(&injection_queue);
+            if (task != NULL) {
+                sim_stats.injected[my_id]++;
+                sim_trace(my_id, TRACE_INJECTED, task, -1, 0);
+            }
+        }
+
+        // check own queue size and work
+        pthread_mutex_lock(&(my_queue->mutex));
+        int my_queue_size = my_queue->size;
+        int my_queue_work = my_queue->work;
+        pthread_mutex_unlock(&(my_queue->mutex));
+        updateWatermarks(wm, my_queue_size, my_queue_work);
+
+        // push mode: overloaded cores offload to the least loaded core
+        if (sim_config.balance_mode != BALANCE_PULL) {
+            pushToOthers(my_id, my_queue);
+        }
+
+        if (task == NULL || (my_queue_size < wm->low_len && my_queue_work < wm->low)) {
+            // queue is empty | below low watermark
+            // attempt fetch tasks from other cores, push mode only waits
+            Task* stolen_task = NULL;
+            if (sim_config.balance_mode != BALANCE_PUSH) {
+                stolen_task = stealFromOthers(my_id, my_queue);
+            }
+
+            if (task == NULL) {
+                task = stolen_task;
+            } else if (stolen_task != NULL) {
+                // still busy, keep stolen task for later
+                submitTask(my_queue, stolen_task);
+            }
+
+            if (task == NULL) {
+                // no tasks to fetch,core can sleep 
+                if (sim_config.elastic) balanceCores(my_id, my_queue);
+                sim_trace(my_id, TRACE_IDLE, NULL, -1, (int) (1000 * sim_config.time_scale));
+                usleep(1000); // sleep for 1 ms
+                continue;
+            }
+        }
+
+        // execute task for its quantum, back to back without the queue
+        int quantum = taskQuantum(task);
+        int cycles = 0;
+        int corun = 0;
+        if (sim_config.gang_mode != GANG_OFF) {
+            corun = atomic_fetch_add(&group_running[task->group], 1) > 0;
+        }
+        while (cycles < quantum && task->task_duration > 0) {
+            executeJob(task, my_queue, my_id);
+            cycles++;
+        }
+        sim_stats.dispatches[my_id]++;
+
+        if (sim_config.gang_mode != GANG_OFF) {
+            // group members ran next to it, shared data is warm
+            if (atomic_fetch_sub(&group_running[task->group], 1) > 1) corun = 1;
+            if (corun) {
+                sim_stats.corun_cycles[my_id] += cycles;
+                task->cache_warmed_up += GANG_CACHE_BONUS * cycles;
+                if (task->cache_warmed_up > MAX_CACHE_FACTOR) task->cache_warmed_up = MAX_CACHE_FACTOR;
+            }
+        }
+
+        // task used whole quantum and still runs, give it a longer one next time
+        if (cycles == quantum && task->task_duration > 0 && task->quantum < QUANTUM_MAX) {
+            task->quantum *= 2;
+        }
+
+        if (sim_config.queue_discipline == QUEUE_MLFQ) {
+            // demote task once it used up allotment of its level
+            task->level_cycles += cycles;
+            if (task->level < MLFQ_LEVELS - 1 && task->level_cycles >= MLFQ_ALLOTMENT << task->level) {
+                task->level++;
+                task->level_cycles = 0;
+            }
+
+            // periodic boost so long tasks don't starve
+            cycles_since_boost += cycles;
+            if (cycles_since_boost >= MLFQ_BOOST_PERIOD) {
+                boostQueue(my_queue);
+                task->level = 0;
+                task->level_cycles = 0;
+                cycles_since_boost = 0;
+            }
+        }
+
+        // check if task finished
+        if (task->task_duration > 0) {
+            // check if anything else waits in own queue
+            pthread_mutex_lock(&(my_queue->mutex));
+            int queued = my_queue->size;
+            pthread_mutex_unlock(&(my_queue->mutex));
+
+            if (queued == 0) {
+                // nothing to round robin with, keep task hot in next slot
+                my_queue->next = task;
+            } else {
+                // submit task back to own queue
+                submitTask(my_queue, task);
+            }
+            sim_trace(my_id, TRACE_RESUBMIT, task, -1, task->task_duration);
+        } else {
+            // successors whose last predecessor this was are ready now,
+            // keep them on this core where the data is, first one runs next
+            for (int i = 0; i < task->num_successors; i++) {
+                Task* successor = task->successors[i];
+                if (atomic_fetch_sub(&successor->pending_preds, 1) == 1) {
+                    successor->owner = my_queue;
+                    if (my_queue->next == NULL) {
+                        my_queue->next = successor;
+                    } else {
+                        submitTask(my_queue, successor);
+                    }
+                    sim_trace(my_id, TRACE_RELEASE, successor, -1, 0);
+                }
+            }
+        }
+        // finished tasks are owned by the loader arena, nothing to free
+
+        // elastic mode: give up core or wake another one
+        if (sim_config.elastic) balanceCores(my_id, my_queue);
+    }
+
+    pthread_exit(NULL);
+}
+
+// initialize shared vars and mutexes
+void initSharedVariables() {
+    // tail steal is the baseline, affinity uses the cache cost model,
+    // critical prefers tasks heading long dependency chains
+    if (sim_config.steal_policy == STEAL_AFFINITY) {
+        stealTask = fetchTaskByAffinity;
+    } else if (sim_config.steal_policy == STEAL_CRITICAL) {
+        stealTask = fetchTaskByCriticalPath;
+    } else {
+        stealTask = fetchTaskFromOthers;
+    }
+
+    initInjectionQueue(&injection_queue);
+
+    // gang mode group counters, first window opens right away
+    group_running = malloc((num_groups + 1) * sizeof(atomic_int));
+    for (int group = 0; group < num_groups; group++) {
+        atomic_init(&group_running[group], 0);
+    }
+    atomic_init(&gang_group, 0);
+    atomic_init(&gang_window_end_ms, 0);
+
+    for (int i = 0; i < NUM_CORES; i++) {
+        pthread_mutex_init(&(processor_queues[i]->mutex), NULL);
+        processor_queues[i]->head = NULL;
+        processor_queues[i]->tail = NULL;
+        for (int level = 0; level < MLFQ_LEVELS; level++) {
+            processor_queues[i]->level_tail[level] = NULL;
+        }
+        processor_queues[i]->size = 0;
+        processor_queues[i]->work = 0;
+        processor_queues[i]->next = NULL;
+        atomic_init(&parked[i], 0);
+        atomic_init(&core_load[i], 0);
+        atomic_init(&core_tasks[i], 0);
+
+        // start from the fixed watermarks, tuned while running
+        watermarks[i].low = LOW_WATERMARK * CYCLE;
+        watermarks[i].low_len = LOW_WATERMARK;
+        watermarks[i].high = HIGH_WATERMARK * CYCLE;
+        watermarks[i].avg_len = 0;
+        watermarks[i].avg_work = 0;
+        watermarks[i].steal_success = 0;
+    }
+}
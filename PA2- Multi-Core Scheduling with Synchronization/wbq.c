@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <limits.h>
+#include "constants.h"
 #include "wbq.h"
+#include "sim_stats.h"
 
-// submiting task to tail of queue (owner thread)
+// submiting task to tail of its priority level (owner thread)
+// with every task on level 0 this is the plain tail of the queue
 void submitTask(WorkBalancerQueue* q, Task* _task) {
     // create new queuenode
     QueueNode* node = (QueueNode*)malloc(sizeof(QueueNode));
@@ -14,19 +18,30 @@ void submitTask(WorkBalancerQueue* q, Task* _task) {
     // lock queue mutex
     pthread_mutex_lock(&(q->mutex));
 
-    // insert node at tail of queue
-    if (q->tail == NULL) {
-        // empty queueu
+    // find last node of same or higher priority level
+    QueueNode* prev = NULL;
+    for (int level = _task->level; level >= 0 && prev == NULL; level--) {
+        prev = q->level_tail[level];
+    }
+
+    // insert node after it, or at head if there is none
+    node->prev = prev;
+    node->next = prev != NULL ? prev->next : q->head;
+    if (node->prev != NULL) {
+        node->prev->next = node;
+    } else {
         q->head = node;
-        q->tail = node;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node;
     } else {
-        node->prev = q->tail;
-        q->tail->next = node;
         q->tail = node;
     }
+    q->level_tail[_task->level] = node;
 
-    // increment queue size
+    // increment queue size and queued work
     q->size++;
+    q->work += _task->task_duration;
 
     // unloc queue mutex
     pthread_mutex_unlock(&(q->mutex));
@@ -46,17 +61,7 @@ Task* fetchTask(WorkBalancerQueue* q) {
     // remove node from head
     QueueNode* node = q->head;
     Task* task = node->task;
-
-    q->head = node->next;
-    if (q->head != NULL) {
-        q->head->prev = NULL;
-    } else {
-        // queue is empty here
-        q->tail = NULL;
-    }
-
-    // decrement queue size
-    q->size--;
+    removeNode(q, node);
 
     // free node
     free(node);
@@ -81,23 +86,259 @@ Task* fetchTaskFromOthers(WorkBalancerQueue* q) {
     // remove node from tail
     QueueNode* node = q->tail;
     Task* task = node->task;
+    removeNode(q, node);
+
+    // free node
+    free(node);
+
+    // unlock queue mutex
+    pthread_mutex_unlock(&(q->mutex));
+
+    return task;
+}
 
-    q->tail = node->prev;
-    if (q->tail != NULL) {
-        q->tail->next = NULL;
+// unlink node from any position, caller holds queue mutex
+void removeNode(WorkBalancerQueue* q, QueueNode* node) {
+    // move level tail back if node was last of its level
+    int level = node->task->level;
+    if (q->level_tail[level] == node) {
+        if (node->prev != NULL && node->prev->task->level == level) {
+            q->level_tail[level] = node->prev;
+        } else {
+            q->level_tail[level] = NULL;
+        }
+    }
+
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        q->head = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
     } else {
-        // queue is empty here
-        q->head = NULL;
+        q->tail = node->prev;
     }
 
-    // decrement queue size
+    // decrement queue size and queued work
     q->size--;
+    q->work -= node->task->task_duration;
+}
+
+// extra ms the thief spends on task because its cache warm up is lost
+int migrationCost(Task* task) {
+    long cold_cycles = cycles_to_finish(task->task_duration, 1.0);
+    long warm_cycles = cycles_to_finish(task->task_duration, task->cache_warmed_up);
+    return (cold_cycles - warm_cycles) * CYCLE;
+}
+
+// fetch task from another cores queue using cache affinity cost model
+// work moved to the thief counts for the task, lost warm up against it,
+// so cold and long remaining tasks win over highly warmed ones
+Task* fetchTaskByAffinity(WorkBalancerQueue* q) {
+    // lock queue mutex
+    pthread_mutex_lock(&(q->mutex));
+
+    // scan from tail, at most STEAL_SCAN_LIMIT nodes
+    QueueNode* best = NULL;
+    int best_score = INT_MIN;
+    int scanned = 0;
+    for (QueueNode* node = q->tail; node != NULL && scanned < STEAL_SCAN_LIMIT; node = node->prev) {
+        int score = node->task->task_duration - migrationCost(node->task);
+        if (score > best_score) {
+            best = node;
+            best_score = score;
+        }
+        scanned++;
+    }
+
+    // check if queue empty
+    if (best == NULL) {
+        pthread_mutex_unlock(&(q->mutex));
+        return NULL;
+    }
+
+    // remove best node
+    Task* task = best->task;
+    removeNode(q, best);
 
     // free node
-    free(node);
+    free(best);
 
     // unlock queue mutex
     pthread_mutex_unlock(&(q->mutex));
 
     return task;
 }
+
+// fetch task with the longest remaining critical path from another cores queue
+// tasks heading long dependency chains move first so the chain starts early
+Task* fetchTaskByCriticalPath(WorkBalancerQueue* q) {
+    // lock queue mutex
+    pthread_mutex_lock(&(q->mutex));
+
+    // scan from tail, at most STEAL_SCAN_LIMIT nodes
+    QueueNode* best = NULL;
+    int scanned = 0;
+    for (QueueNode* node = q->tail; node != NULL && scanned < STEAL_SCAN_LIMIT; node = node->prev) {
+        if (best == NULL || node->task->critical_ms > best->task->critical_ms) {
+            best = node;
+        }
+        scanned++;
+    }
+
+    // check if queue empty
+    if (best == NULL) {
+        pthread_mutex_unlock(&(q->mutex));
+        return NULL;
+    }
+
+    // remove best node
+    Task* task = best->task;
+    removeNode(q, best);
+
+    // free node
+    free(best);
+
+    // unlock queue mutex
+    pthread_mutex_unlock(&(q->mutex));
+
+    return task;
+}
+
+// fetch first task of group from a queue, own or another cores
+// scans from head so an owner keeps its round robin order within the group
+Task* fetchTaskOfGroup(WorkBalancerQueue* q, int group) {
+    // lock queue mutex
+    pthread_mutex_lock(&(q->mutex));
+
+    // scan from head, at most STEAL_SCAN_LIMIT nodes
+    QueueNode* found = NULL;
+    int scanned = 0;
+    for (QueueNode* node = q->head; node != NULL && scanned < STEAL_SCAN_LIMIT; node = node->next) {
+        if (node->task->group == group) {
+            found = node;
+            break;
+        }
+        scanned++;
+    }
+
+    // check if no task of group
+    if (found == NULL) {
+        pthread_mutex_unlock(&(q->mutex));
+        return NULL;
+    }
+
+    // remove found node
+    Task* task = found->task;
+    removeNode(q, found);
+
+    // free node
+    free(found);
+
+    // unlock queue mutex
+    pthread_mutex_unlock(&(q->mutex));
+
+    return task;
+}
+
+// priority boost, move every queued task back to the top level
+void boostQueue(WorkBalancerQueue* q) {
+    // lock queue mutex
+    pthread_mutex_lock(&(q->mutex));
+
+    for (QueueNode* node = q->head; node != NULL; node = node->next) {
+        node->task->level = 0;
+        node->task->level_cycles = 0;
+    }
+
+    // the next slot is owner only, boostQueue is only called by the owner
+    if (q->next != NULL) {
+        q->next->level = 0;
+        q->next->level_cycles = 0;
+    }
+
+    // queue order is kept, it is all one level now
+    for (int level = 0; level < MLFQ_LEVELS; level++) {
+        q->level_tail[level] = NULL;
+    }
+    q->level_tail[0] = q->tail;
+
+    // unlock queue mutex
+    pthread_mutex_unlock(&(q->mutex));
+}
+
+// prepare every cell for the first lap of the ring
+void initInjectionQueue(InjectionQueue* q) {
+    for (size_t i = 0; i < INJECT_QUEUE_SIZE; i++) {
+        atomic_init(&(q->cells[i].sequence), i);
+        q->cells[i].task = NULL;
+    }
+    atomic_init(&(q->enqueue_pos), 0);
+    atomic_init(&(q->dequeue_pos), 0);
+}
+
+// add task to injection queue (any thread), returns -1 if it is full
+int injectTask(InjectionQueue* q, Task* task) {
+    size_t pos = atomic_load_explicit(&(q->enqueue_pos), memory_order_relaxed);
+    InjectionCell* cell;
+    for (;;) {
+        cell = &(q->cells[pos & (INJECT_QUEUE_SIZE - 1)]);
+        size_t seq = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+        long diff = (long) seq - (long) pos;
+        if (diff == 0) {
+            // cell is free on this lap, claim position
+            if (atomic_compare_exchange_weak_explicit(&(q->enqueue_pos), &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // cell still holds a task from the previous lap, ring is full
+            return -1;
+        } else {
+            // another producer got this position first
+            pos = atomic_load_explicit(&(q->enqueue_pos), memory_order_relaxed);
+        }
+    }
+
+    // publish task to consumers
+    cell->task = task;
+    atomic_store_explicit(&(cell->sequence), pos + 1, memory_order_release);
+    return 0;
+}
+
+// number of tasks waiting in injection queue, a snapshot (any thread)
+int injectedTasks(InjectionQueue* q) {
+    size_t dequeue_pos = atomic_load_explicit(&(q->dequeue_pos), memory_order_relaxed);
+    size_t enqueue_pos = atomic_load_explicit(&(q->enqueue_pos), memory_order_relaxed);
+    return enqueue_pos > dequeue_pos ? (int) (enqueue_pos - dequeue_pos) : 0;
+}
+
+// take oldest task from injection queue (any thread), NULL if it is empty
+Task* fetchInjectedTask(InjectionQueue* q) {
+    size_t pos = atomic_load_explicit(&(q->dequeue_pos), memory_order_relaxed);
+    InjectionCell* cell;
+    for (;;) {
+        cell = &(q->cells[pos & (INJECT_QUEUE_SIZE - 1)]);
+        size_t seq = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+        long diff = (long) seq - (long) (pos + 1);
+        if (diff == 0) {
+            // cell holds a task, claim position
+            if (atomic_compare_exchange_weak_explicit(&(q->dequeue_pos), &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // producer has not filled cell yet, queue is empty
+            return NULL;
+        } else {
+            // another consumer got this position first
+            pos = atomic_load_explicit(&(q->dequeue_pos), memory_order_relaxed);
+        }
+    }
+
+    // free cell for next lap of producers
+    Task* task = cell->task;
+    atomic_store_explicit(&(cell->sequence), pos + INJECT_QUEUE_SIZE, memory_order_release);
+    return task;
+}
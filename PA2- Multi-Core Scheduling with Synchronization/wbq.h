@@ -2,12 +2,43 @@
 #define WBQ_H
 
 #include <pthread.h>
+#include <stdatomic.h>
+
+// multilevel feedback queue: a task is demoted after MLFQ_ALLOTMENT << level
+// cycles on its level, every core boosts its queue each MLFQ_BOOST_PERIOD cycles
+#define MLFQ_LEVELS 4
+#define MLFQ_ALLOTMENT 2
+#define MLFQ_BOOST_PERIOD 50
+
+// adaptive quantum: a task runs quantum cycles per dispatch, doubled each
+// time it uses the whole quantum, up to QUANTUM_MAX. A remainder of at most
+// QUANTUM_FINISH_SLACK cycles past the quantum runs to completion.
+#define QUANTUM_MAX 8
+#define QUANTUM_FINISH_SLACK 1
+
+// gang scheduling: each window of GANG_WINDOW cycles belongs to one task
+// group whose tasks cores run first. A task running while another task of
+// its group runs on another core gains GANG_CACHE_BONUS cache factor per
+// cycle on top of CACHE_FACTOR, for the data the group shares.
+#define GANG_WINDOW 4
+#define GANG_CACHE_BONUS 0.05
 
 typedef struct Task {
     char* task_id;
     int task_duration;
     double cache_warmed_up;
     struct WorkBalancerQueue* owner;
+    int level;                  // MLFQ priority level, 0 is highest
+    int level_cycles;           // cycles consumed on current level
+    int quantum;                // cycles per dispatch under the adaptive quantum
+    long release_ms;            // simulated time task arrived
+    long finish_ms;             // simulated time task finished
+    struct Task** successors;   // tasks that depend on this one
+    int num_successors;
+    atomic_int pending_preds;   // unfinished predecessors, plus one until released
+    long critical_ms;           // longest path from this task to the end of the DAG
+    void* working_set;          // buffer touched each cycle in real work mode
+    int group;                  // task group, tasks of a group share data
 } Task;
 
 //   declare WorkBalancerQueue
@@ -24,10 +55,64 @@ typedef struct QueueNode {
 struct WorkBalancerQueue {
     QueueNode* head;            // Head of the queue
     QueueNode* tail;            // Tail of the queue
+    QueueNode* level_tail[MLFQ_LEVELS]; // Last node of each level, queue is sorted by level
     int size;                   // Number of tasks in the queue
+    int work;                   // Sum of task_duration of queued tasks
     pthread_mutex_t mutex;      // Mutex for synchronization
+    Task* next;                 // Task the owner runs next, owner thread only, not in work
 };
 
+// global injection queue, a bounded lock-free MPMC ring for tasks that are
+// not bound to a core, idle cores drain it before stealing
+#define INJECT_QUEUE_SIZE 1024  // must be a power of two
+#define INJECT_CACHE_LINE 64
+
+typedef struct InjectionCell {
+    atomic_size_t sequence;     // position the cell is ready for
+    Task* task;
+} InjectionCell;
+
+typedef struct InjectionQueue {
+    _Alignas(INJECT_CACHE_LINE) atomic_size_t enqueue_pos;
+    _Alignas(INJECT_CACHE_LINE) atomic_size_t dequeue_pos;
+    _Alignas(INJECT_CACHE_LINE) InjectionCell cells[INJECT_QUEUE_SIZE];
+} InjectionQueue;
+
+// starting watermarks in tasks of one CYCLE, tuned per core while running
+#define LOW_WATERMARK 10
+#define HIGH_WATERMARK 20
+#define WATERMARK_EWMA 0.1      // weight of newest sample in the averages
+
+// per core load balancing thresholds, measured in ms of queued work
+typedef struct Watermarks {
+    double low;                 // own work under which the core looks for more
+    double low_len;             // own queue length under which the core looks for more
+    double high;                // victim work over which stealing is allowed
+    double avg_len;             // average own queue length
+    double avg_work;            // average own queued work
+    double steal_success;       // fraction of steal attempts that got a task
+} Watermarks;
+
+// push mode: a core with more queued work than PUSH_WATERMARK cycles and
+// twice the least loaded core gives away up to PUSH_BATCH tasks per cycle
+#define PUSH_WATERMARK 4
+#define PUSH_BATCH 4
+
+// elastic mode: the least loaded active core parks when all load fits on one core
+// less at PARK_WORK cycles each and there are fewer tasks than active cores,
+// a parked core is woken when the load goes
+// over UNPARK_WORK cycles per active core, parked cores check their own queue
+// and the injection queue every PARK_POLL_MS
+#define PARK_WORK 3
+#define UNPARK_WORK 15
+#define PARK_POLL_MS 10
+
+// max nodes the affinity steal policy looks at
+#define STEAL_SCAN_LIMIT 32
+
+// steal policy, picks and removes a task from a victim queue
+typedef Task* (*StealPolicy)(WorkBalancerQueue* q);
+
 //this was given in document
 typedef struct ThreadArguments {
     WorkBalancerQueue* q;
@@ -38,6 +123,18 @@ typedef struct ThreadArguments {
 void submitTask(WorkBalancerQueue* q, Task* _task);
 Task* fetchTask(WorkBalancerQueue* q);
 Task* fetchTaskFromOthers(WorkBalancerQueue* q);
+Task* fetchTaskByAffinity(WorkBalancerQueue* q);
+Task* fetchTaskByCriticalPath(WorkBalancerQueue* q);
+Task* fetchTaskOfGroup(WorkBalancerQueue* q, int group);
+void removeNode(WorkBalancerQueue* q, QueueNode* node);
+void boostQueue(WorkBalancerQueue* q);
+int migrationCost(Task* task);
+
+// InjectionQueue api
+void initInjectionQueue(InjectionQueue* q);
+int injectTask(InjectionQueue* q, Task* task);
+Task* fetchInjectedTask(InjectionQueue* q);
+int injectedTasks(InjectionQueue* q);
 
 // simulator thread funcs
 void executeJob(Task* task, WorkBalancerQueue* my_queue, int my_id);
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "wbq_shm.h"
+
+// rebuild queue of core from per task state after its lock owner died
+// list links may be half updated, queue and seq fields are always valid
+static void rebuildQueue(ShmSegment* seg, int core) {
+    ShmQueue* q = &(seg->queues[core]);
+    q->head = SHM_NIL;
+    q->tail = SHM_NIL;
+    q->size = 0;
+    q->work = 0;
+
+    // insert every task of this queue in seq order
+    for (int i = 0; i < seg->num_tasks; i++) {
+        ShmTask* task = &(seg->tasks[i]);
+        if (task->queue != core) continue;
+
+        // find first queued task with higher seq
+        int after = q->tail;
+        while (after != SHM_NIL && seg->tasks[after].seq > task->seq) {
+            after = seg->tasks[after].prev;
+        }
+        task->prev = after;
+        task->next = after != SHM_NIL ? seg->tasks[after].next : q->head;
+        if (task->prev != SHM_NIL) {
+            seg->tasks[task->prev].next = i;
+        } else {
+            q->head = i;
+        }
+        if (task->next != SHM_NIL) {
+            seg->tasks[task->next].prev = i;
+        } else {
+            q->tail = i;
+        }
+        q->size++;
+        q->work += task->task_duration;
+    }
+
+    // a task being run by the dead worker is in no queue, running still names it
+    q->recoveries++;
+}
+
+// lock queue mutex, repairing queue if previous owner died with it
+static void lockQueue(ShmSegment* seg, int core) {
+    ShmQueue* q = &(seg->queues[core]);
+    int rc = pthread_mutex_lock(&(q->mutex));
+    if (rc == EOWNERDEAD) {
+        rebuildQueue(seg, core);
+        pthread_mutex_consistent(&(q->mutex));
+    }
+}
+
+// unlink task from queue, caller holds queue mutex
+static void removeShmNode(ShmSegment* seg, int core, int i) {
+    ShmQueue* q = &(seg->queues[core]);
+    ShmTask* task = &(seg->tasks[i]);
+
+    if (task->prev != SHM_NIL) {
+        seg->tasks[task->prev].next = task->next;
+    } else {
+        q->head = task->next;
+    }
+    if (task->next != SHM_NIL) {
+        seg->tasks[task->next].prev = task->prev;
+    } else {
+        q->tail = task->prev;
+    }
+    q->size--;
+    q->work -= task->task_duration;
+
+    // queue field last, a crash before this keeps task in the queue
+    task->queue = SHM_NIL;
+}
+
+static ShmSegment* mapSegment(int fd, size_t size) {
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return addr == MAP_FAILED ? NULL : (ShmSegment*) addr;
+}
+
+ShmSegment* shmCreate(const char* name, int num_cores, int num_tasks) {
+    if (num_cores > SHM_MAX_CORES) return NULL;
+
+    // create segment, replacing one left over by an earlier run
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return NULL;
+    size_t size = sizeof(ShmSegment) + (size_t) num_tasks * sizeof(ShmTask);
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    ShmSegment* seg = mapSegment(fd, size);
+    if (seg == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    seg->num_cores = num_cores;
+    seg->num_tasks = num_tasks;
+    seg->size = size;
+
+    // process shared robust mutexes, so attached processes can use them
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    for (int core = 0; core < num_cores; core++) {
+        ShmQueue* q = &(seg->queues[core]);
+        pthread_mutex_init(&(q->mutex), &attr);
+        q->head = SHM_NIL;
+        q->tail = SHM_NIL;
+        q->size = 0;
+        q->work = 0;
+        q->next_seq = 0;
+        q->running = SHM_NIL;
+        q->worker = 0;
+        q->recoveries = 0;
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    for (int i = 0; i < num_tasks; i++) {
+        seg->tasks[i].owner = SHM_NIL;
+        seg->tasks[i].next = SHM_NIL;
+        seg->tasks[i].prev = SHM_NIL;
+        seg->tasks[i].queue = SHM_NIL;
+        atomic_init(&(seg->tasks[i].done), 0);
+    }
+
+    // magic last, attach refuses half initialized segments
+    seg->magic = SHM_MAGIC;
+    return seg;
+}
+
+ShmSegment* shmAttach(const char* name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ShmSegment)) {
+        close(fd);
+        return NULL;
+    }
+    ShmSegment* seg = mapSegment(fd, st.st_size);
+    if (seg != NULL && (seg->magic != SHM_MAGIC || seg->size != (size_t) st.st_size)) {
+        munmap(seg, st.st_size);
+        return NULL;
+    }
+    return seg;
+}
+
+void shmDetach(ShmSegment* seg) {
+    munmap(seg, seg->size);
+}
+
+void shmDestroy(const char* name, ShmSegment* seg) {
+    for (int core = 0; core < seg->num_cores; core++) {
+        pthread_mutex_destroy(&(seg->queues[core].mutex));
+    }
+    shmDetach(seg);
+    shm_unlink(name);
+}
+
+// submit task to tail of queue of core
+void shmSubmitTask(ShmSegment* seg, int core, int i) {
+    ShmQueue* q = &(seg->queues[core]);
+    ShmTask* task = &(seg->tasks[i]);
+
+    // lock queue mutex
+    lockQueue(seg, core);
+
+    // queue and seq first, a crash after this still finds task on rebuild
+    task->seq = q->next_seq++;
+    task->queue = core;
+    if (q->running == i) q->running = SHM_NIL;
+
+    // link at tail
+    task->next = SHM_NIL;
+    task->prev = q->tail;
+    if (q->tail != SHM_NIL) {
+        seg->tasks[q->tail].next = i;
+    } else {
+        q->head = i;
+    }
+    q->tail = i;
+
+    // increment queue size and queued work
+    q->size++;
+    q->work += task->task_duration;
+
+    // unlock queue mutex
+    pthread_mutex_unlock(&(q->mutex));
+}
+
+// fetch task from head of own queue, it becomes the running task of core
+int shmFetchTask(ShmSegment* seg, int core) {
+    ShmQueue* q = &(seg->queues[core]);
+
+    // lock queue mutex
+    lockQueue(seg, core);
+
+    int i = q->head;
+    if (i != SHM_NIL) {
+        // running first, so a crash in between leaves task queued, not lost
+        q->running = i;
+        removeShmNode(seg, core, i);
+    }
+
+    // unlock queue mutex
+    pthread_mutex_unlock(&(q->mutex));
+    return i;
+}
+
+// steal task from tail of victim queue, it becomes the running task of thief
+int shmFetchTaskFromOthers(ShmSegment* seg, int victim, int thief) {
+    ShmQueue* q = &(seg->queues[victim]);
+
+    // lock victim queue mutex
+    lockQueue(seg, victim);
+
+    int i = q->tail;
+    if (i != SHM_NIL) {
+        // only thief writes its running field, no need for its lock
+        seg->queues[thief].running = i;
+        removeShmNode(seg, victim, i);
+    }
+
+    // unlock victim queue mutex
+    pthread_mutex_unlock(&(q->mutex));
+    return i;
+}
+
+// core finished its running task
+void shmFinishRun(ShmSegment* seg, int core) {
+    // done first, a crash before clearing running leaves nothing to redo
+    ShmQueue* q = &(seg->queues[core]);
+    atomic_store(&(seg->tasks[q->running].done), 1);
+    q->running = SHM_NIL;
+}
+
+// count finished tasks, no counter to lose when a worker dies mid update
+int shmFinishedTasks(ShmSegment* seg) {
+    int finished = 0;
+    for (int i = 0; i < seg->num_tasks; i++) {
+        finished += atomic_load(&(seg->tasks[i].done));
+    }
+    return finished;
+}
+
+// queued work of core, for steal decisions
+int shmQueueWork(ShmSegment* seg, int core) {
+    ShmQueue* q = &(seg->queues[core]);
+    lockQueue(seg, core);
+    int work = q->work;
+    pthread_mutex_unlock(&(q->mutex));
+    return work;
+}
+
+void shmRecoverCore(ShmSegment* seg, int core) {
+    ShmQueue* q = &(seg->queues[core]);
+
+    // lock queue mutex, rebuilds queue if worker died holding it
+    lockQueue(seg, core);
+    int i = q->running;
+    q->running = SHM_NIL;
+    pthread_mutex_unlock(&(q->mutex));
+
+    if (i == SHM_NIL || seg->tasks[i].queue != SHM_NIL) return;
+
+    if (seg->tasks[i].task_duration == 0) {
+        // worker died between last cycle and shmFinishRun
+        atomic_store(&(seg->tasks[i].done), 1);
+    } else {
+        // running task goes back to queue with its progress up to the last cycle
+        seg->tasks[i].owner = SHM_NIL;
+        shmSubmitTask(seg, core, i);
+    }
+}
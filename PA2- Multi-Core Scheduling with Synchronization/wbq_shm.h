@@ -0,0 +1,70 @@
+#ifndef WBQ_SHM_H
+#define WBQ_SHM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+// shared memory variant of WorkBalancerQueue for cores that are separate
+// processes. Everything lives in one POSIX shared memory segment that each
+// process may map at a different address, so links are task offsets into
+// the segment's task table instead of pointers. Queue mutexes are process
+// shared and robust: when a worker dies holding one, the next locker
+// rebuilds that queue from the per task state and carries on.
+
+#define SHM_NIL -1              // offset of no task
+#define SHM_ID_LEN 32           // task ids must be shorter than this, sim_mp rejects longer ones
+#define SHM_MAX_CORES 64
+#define SHM_MAGIC 0x57425153    // "WBQS"
+
+typedef struct ShmTask {
+    char task_id[SHM_ID_LEN];
+    int task_duration;
+    double cache_warmed_up;
+    int owner;                  // core that ran task last, SHM_NIL if none
+    int next;                   // queue links, task offsets
+    int prev;
+    int queue;                  // core whose queue holds task, SHM_NIL if none
+    long seq;                   // enqueue order, used to rebuild a queue
+    atomic_int done;            // set once task finished, a single store survives crashes
+} ShmTask;
+
+typedef struct ShmQueue {
+    pthread_mutex_t mutex;      // process shared, robust
+    int head;                   // head of the queue
+    int tail;                   // tail of the queue
+    int size;                   // number of tasks in the queue
+    int work;                   // sum of task_duration of queued tasks
+    long next_seq;              // seq of next submitted task
+    int running;                // task the core is executing, SHM_NIL if none
+    pid_t worker;               // process serving this core
+    int recoveries;             // times the queue was rebuilt after a crash
+} ShmQueue;
+
+typedef struct ShmSegment {
+    int magic;
+    int num_cores;
+    int num_tasks;
+    size_t size;                // bytes mapped
+    ShmQueue queues[SHM_MAX_CORES];
+    ShmTask tasks[];            // task table, offsets index this
+} ShmSegment;
+
+// segment lifetime, create and attach return NULL on error
+ShmSegment* shmCreate(const char* name, int num_cores, int num_tasks);
+ShmSegment* shmAttach(const char* name);
+void shmDetach(ShmSegment* seg);
+void shmDestroy(const char* name, ShmSegment* seg);
+
+// shared WorkBalancerQueue api, tasks are passed as offsets
+void shmSubmitTask(ShmSegment* seg, int core, int task);
+int shmFetchTask(ShmSegment* seg, int core);
+int shmFetchTaskFromOthers(ShmSegment* seg, int victim, int thief);
+void shmFinishRun(ShmSegment* seg, int core);
+int shmFinishedTasks(ShmSegment* seg);
+int shmQueueWork(ShmSegment* seg, int core);
+
+// give a dead worker's running task back to its queue, caller is the supervisor
+void shmRecoverCore(ShmSegment* seg, int core);
+
+#endif
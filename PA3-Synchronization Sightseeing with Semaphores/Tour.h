@@ -3,182 +3,693 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdint.h>
 #include <exception>
 #include <stdexcept>
 #include <stdio.h>
+#include "TourSync.h"
+#include "TourLog.h"
+
+// Arrival to tour start latencies are kept in log-linear buckets, each
+// power of two microseconds split into TOUR_HIST_SUB buckets
+#define TOUR_HIST_SUB_BITS 3
+#define TOUR_HIST_SUB (1 << TOUR_HIST_SUB_BITS)
+#define TOUR_HIST_BUCKETS (40 * TOUR_HIST_SUB)
+
+static inline int tourHistBucket(long micros) {
+    if (micros < TOUR_HIST_SUB) {
+        return micros < 0 ? 0 : (int) micros;
+    }
+    int exponent = 63 - __builtin_clzl((unsigned long) micros);
+    int sub = (int) (micros >> (exponent - TOUR_HIST_SUB_BITS)) & (TOUR_HIST_SUB - 1);
+    int bucket = (exponent - TOUR_HIST_SUB_BITS + 1) * TOUR_HIST_SUB + sub;
+    return bucket < TOUR_HIST_BUCKETS ? bucket : TOUR_HIST_BUCKETS - 1;
+}
+
+// Smallest latency falling into bucket
+static inline long tourHistLow(int bucket) {
+    if (bucket < TOUR_HIST_SUB) {
+        return bucket;
+    }
+    int exponent = bucket / TOUR_HIST_SUB + TOUR_HIST_SUB_BITS - 1;
+    return (long) (TOUR_HIST_SUB + bucket % TOUR_HIST_SUB) << (exponent - TOUR_HIST_SUB_BITS);
+}
+
+// Counters collected by a Tour, read with Tour::stats()
+struct TourStats {
+    unsigned long tours;        // Tours started
+    int peakTours;              // Most tours running at the same time
+    unsigned long gateWaits;    // Arrivals that slept at the admission gate
+    unsigned long gateWakeups;  // Threads woken by the admission gate
+    unsigned long endWakeups;   // Visitors woken by tourEnd
+    long gateWaitMicros;        // Time spent waiting for admission, all visitors
+    long mutexWaitMicros;       // Real time spent waiting for the mutex when it was taken
+    unsigned long toured;       // Visitors who went on a tour
+    unsigned long partialTours; // Tours started short of a full group by a deadline
+    unsigned long emptyPlaces;  // Places those tours left empty
+    unsigned long earlyLeaves;  // Visitors who left before their tour started, at the gate or in the group
+    unsigned long waitHistogram[TOUR_HIST_BUCKETS]; // Arrival to tour start of those visitors
+
+    // Latency below which fraction q of the visitors who toured started, in microseconds
+    long waitPercentile(double q) const {
+        unsigned long rank = (unsigned long) (q * toured);
+        unsigned long seen = 0;
+        for (int i = 0; i < TOUR_HIST_BUCKETS; i++) {
+            seen += waitHistogram[i];
+            if (seen > rank) {
+                return tourHistLow(i);
+            }
+        }
+        return toured > 0 ? tourHistLow(TOUR_HIST_BUCKETS - 1) : 0;
+    }
+};
+
+// Tour state of a slot packed into one word, so it changes with a single CAS:
+// bits 0-15 visitors waiting, 16-31 visitors left, 32 tour started, 33-48
+// shortfall, the places a deadline start took away from the group, and
+// 49-63 generation, the number of tours the slot has finished.
+#define TOUR_WAITING_ONE    ((uint64_t) 1)
+#define TOUR_LEFT_ONE       ((uint64_t) 1 << 16)
+#define TOUR_STARTED        ((uint64_t) 1 << 32)
+#define TOUR_SHORTFALL_ONE  ((uint64_t) 1 << 33)
+#define TOUR_GENERATION_ONE ((uint64_t) 1 << 49)
+#define TOUR_MAX_VISITORS   0xffff
+
+static inline int tourWaiting(uint64_t state) { return (int) (state & 0xffff); }
+static inline int tourLeft(uint64_t state) { return (int) ((state >> 16) & 0xffff); }
+static inline int tourShortfall(uint64_t state) { return (int) ((state >> 33) & 0xffff); }
+
+// What a visitor does once the deadline of its wait for the tour start passed
+enum TourDeadlinePolicy {
+    TOUR_DEADLINE_LEAVE,        // Leave, the camera ran out of memory
+    TOUR_DEADLINE_START_EARLY   // Start the tour with the visitors who are there, at the gate leave
+};
+
+// Maximum wait argument meaning the tour's default
+#define TOUR_DEFAULT_WAIT (-1)
+
+// Next step of a visitor in arrive() once it joined a group
+enum TourArriveStep {
+    TOUR_ARRIVE_LEFT,           // Left the group at the deadline
+    TOUR_ARRIVE_DONE,           // Go on to start()
+    TOUR_ARRIVE_WAIT,           // Wait for tourStart
+    TOUR_ARRIVE_WAIT_UNTIL      // Wait for tourStart until the visitor's deadline
+};
+
+// Next step of a visitor in leave()
+enum TourLeaveStep {
+    TOUR_LEAVE_LEFT,            // Left before the tour started
+    TOUR_LEAVE_DONE,            // The tour is over for the visitor
+    TOUR_LEAVE_WAIT             // Wait for tourEnd
+};
 
-class Tour {
+// State of one tour group. Slots are recycled through a pool, one slot
+// collects the next group while the others may still be touring.
+struct alignas(CACHE_LINE) TourSlot {
+    std::atomic<uint64_t> state; // Waiting, left, started and generation, see above
+    TourSlot* next;             // Next free slot in the pool
+    long startedAt;             // tourClock() when the tour started
+    // Released once per tour, by the guide at the end of the tour, or
+    // without a guide as soon as the tour start has been announced
+    alignas(CACHE_LINE) GenerationBroadcast tourEnd;
+    // Released once per tour when it starts, for visitors waiting in arrive()
+    alignas(CACHE_LINE) GenerationBroadcast tourStart;
+};
+
+// What a visitor remembers between arrive() and leave()
+struct TourVisit {
+    unsigned long id;           // Shown as the thread ID in the status lines
+    long arrivedAt;             // tourClock() when the visitor arrived
+    long deadline;              // tourClock() when the visitor stops waiting for the tour start
+    bool waitLimited;           // A maximum wait was set, the visitor waits in arrive() up to the deadline
+    TourSlot* slot;             // Slot of the group the visitor joined, NULL if it left before the start
+    unsigned startGeneration;   // Generation of tourStart the group waits out
+    unsigned endGeneration;     // Generation of tourEnd the group waits out
+    bool guide;                 // True for the visitor who completed the group, if a guide is required
+    TourLogCursor log;          // Last status line of the visitor
+};
+
+// Template argument of BasicTour for a value given to the constructor instead
+#define TOUR_DYNAMIC (-1)
+
+// Group size known at compile time, or stored when TOUR_DYNAMIC
+template <int GroupSize>
+class TourGroupSize {
 public:
-    // Constructor
-    Tour(int groupSize, int tourGuidePresent);
-    // Destructor
-    ~Tour();
+    explicit TourGroupSize(int) {}
+    int groupSize() const { return GroupSize; }
+};
 
-    void arrive();
-    void start(); // Implemented by you
-    void leave();
+template <>
+class TourGroupSize<TOUR_DYNAMIC> {
+public:
+    explicit TourGroupSize(int size) : size(size) {}
+    int groupSize() const { return size; }
+private:
+    int size;               // Number of visitors needed to start a tour (excluding guide)
+};
+
+// Guide presence known at compile time, or stored when TOUR_DYNAMIC
+template <int Guide>
+class TourGuide {
+public:
+    explicit TourGuide(int) {}
+    int tourGuidePresent() const { return Guide; }
+};
 
+template <>
+class TourGuide<TOUR_DYNAMIC> {
+public:
+    explicit TourGuide(int present) : present(present) {}
+    int tourGuidePresent() const { return present; }
 private:
-    int groupSize;          // Number of visitors needed to start a tour (excluding guide)
-    int tourGuidePresent;   // 1 if guide is required, 0 otherwise
-    int totalVisitorsNeeded;// Total number of people needed to start a tour
-    int visitorsWaiting;    // Number of visitors currently waiting to start a tour
-    int visitorsLeaving;    // Number of visitors who have left the tour
-    bool tourStarted;       // True if tour has started
-    pthread_t guideThreadID;// Thread ID of the tour guide
+    int present;            // 1 if guide is required, 0 otherwise
+};
 
+template <class T> class TourArriveAwaiter;
+template <class T> class TourLeaveAwaiter;
+class FiberSleep;
+
+// Tour synchronization for groups of GroupSize visitors, with a guide if
+// Guide is 1. Known parameters are constants, so the compiler drops the
+// guide or no-guide branches and the group size loads. Either one may be
+// TOUR_DYNAMIC to take it from the constructor, Tour below does that for both.
+template <int GroupSize, int Guide>
+class BasicTour : private TourGroupSize<GroupSize>, private TourGuide<Guide> {
+    static_assert(GroupSize == TOUR_DYNAMIC || (GroupSize > 0 && GroupSize < TOUR_MAX_VISITORS), "Invalid group size");
+    static_assert(Guide == TOUR_DYNAMIC || Guide == 0 || Guide == 1, "Guide must be 0 or 1");
+
+public:
+    // Constructor for compile-time parameters, maxTours groups may tour at the same time
+    explicit BasicTour(int maxTours = 1);
+    // Constructor taking the TOUR_DYNAMIC parameters, the others must match the template
+    BasicTour(int groupSize, int tourGuidePresent, int maxTours = 1);
+    // Destructor
+    ~BasicTour();
+
+    // Visitors wait for their tour to start up to maxWaitMicros after their
+    // arrival, first at the gate and then in the forming group. A visitor
+    // still at the gate at its deadline leaves, in the group it applies
+    // policy. Both waits happen in arrive(), so the
+    // visitor starting a tour early is its guide and runs it in start(), and
+    // nobody who toured waited longer than the deadline for it. The default,
+    // 0 and TOUR_DEADLINE_LEAVE, waits at the gate as long as it takes, then
+    // goes to start() right away and leaves if the group is not complete by
+    // leave(). With 0 and TOUR_DEADLINE_START_EARLY a visitor starts the tour
+    // with whoever is there as soon as it joined. Set before anyone arrives.
+    void setDeadline(long maxWaitMicros, TourDeadlinePolicy policy);
+
+    // maxWaitMicros overrides the tour's maximum wait for this visitor
+    void arrive(long maxWaitMicros = TOUR_DEFAULT_WAIT);
+    void leave();
+
+    // Awaitable versions for visitors running as coroutines, see TourFiber.h
+    TourArriveAwaiter<BasicTour> arriveAsync(TourVisit& visit, long maxWaitMicros = TOUR_DEFAULT_WAIT);
+    TourLeaveAwaiter<BasicTour> leaveAsync(TourVisit& visit);
+
+    TourStats stats() const;
+
+    using TourGroupSize<GroupSize>::groupSize;
+    using TourGuide<Guide>::tourGuidePresent;
+
+    // Total number of people needed to start a tour
+    int totalVisitorsNeeded() const { return groupSize() + tourGuidePresent(); }
+
+private:
+    template <class T> friend class TourArriveAwaiter;
+    template <class T> friend class TourLeaveAwaiter;
+
+    void setArrival(TourVisit& visit, long maxWaitMicros);
+    void leaveGate(TourVisit& visit);
+    void join(TourVisit& visit);
+    void beginTour(TourVisit& visit, TourSlot* slot, long now);
+    TourArriveStep arriveStep(TourVisit& visit);
+    TourLeaveStep leaveStep(TourVisit& visit);
+    void startEarly(TourVisit& visit);
+    bool leaveBeforeStart(TourVisit& visit);
+    void finishVisit(TourVisit& visit);
+    void lock();
+    void startTour();
+    void recycleSlot(TourSlot* slot);
+
+    int maxTours;           // Number of tour slots
+    TourSlot* slots;        // Pool of maxTours slots
+    long maxWait;           // Default wait for the tour start, see setDeadline()
+    TourDeadlinePolicy deadlinePolicy;
+
+    // Slot collecting the next group, NULL while all slots tour. Read by
+    // every arrival, so it gets a line of its own.
+    alignas(CACHE_LINE) std::atomic<TourSlot*> forming;
+
+    // Visit of the calling thread
+    static inline thread_local TourVisit currentVisit;
+
+    // Only touched when a tour starts or ends, protected by mutex
+    alignas(CACHE_LINE) TourSlot* freeSlots; // Slots neither forming nor touring
+    int toursRunning;       // Slots with a tour in progress
+    int peakTours;          // Highest toursRunning so far
+    unsigned long toursStarted; // Number of tours started so far
     sem_t mutex;            // Semaphore for mutual exclusion
-    sem_t tourEnd;          // Semaphore to synchronize end of the tour
-    sem_t arrival;          // Semaphore to block new arrivals when tour is in progress
-    pthread_mutex_t printMutex; // Mutex for print statements
+    long mutexWaitMicros;   // Time spent waiting for mutex
+    unsigned long partialTours; // Tours started early by a deadline
+    unsigned long emptyPlaces;  // Places they left empty
+
+    // Latency statistics, updated by every visitor
+    alignas(CACHE_LINE) std::atomic<long> gateWaitMicros;
+    std::atomic<unsigned long> toured;
+    std::atomic<unsigned long> earlyLeaves;
+    std::atomic<unsigned long> waitHistogram[TOUR_HIST_BUCKETS];
+
+    TicketGate arrival;     // Admits new arrivals in FIFO order, one per free place in the forming group
+};
+
+// The tour with group size and guide chosen at run time, as the test drivers use it
+class Tour : public BasicTour<TOUR_DYNAMIC, TOUR_DYNAMIC> {
+public:
+    // Constructor, maxTours groups may tour at the same time
+    Tour(int groupSize, int tourGuidePresent, int maxTours = 1)
+        : BasicTour<TOUR_DYNAMIC, TOUR_DYNAMIC>(groupSize, tourGuidePresent, maxTours) {}
+
+    void start(); // Implemented by you
+    FiberSleep startAsync(); // Implemented by you, like start()
 };
 
 // Constructor implementation
-Tour::Tour(int groupSize, int tourGuidePresent) {
+template <int GroupSize, int Guide>
+BasicTour<GroupSize, Guide>::BasicTour(int maxTours) : BasicTour(GroupSize, Guide, maxTours) {
+    static_assert(GroupSize != TOUR_DYNAMIC && Guide != TOUR_DYNAMIC, "Pass the TOUR_DYNAMIC parameters to the constructor");
+}
+
+template <int GroupSize, int Guide>
+BasicTour<GroupSize, Guide>::BasicTour(int groupSize, int tourGuidePresent, int maxTours)
+    : TourGroupSize<GroupSize>(groupSize), TourGuide<Guide>(tourGuidePresent), arrival(groupSize + tourGuidePresent) {
     // Check arguments
-    if (groupSize <= 0 || (tourGuidePresent != 0 && tourGuidePresent != 1)) {
+    if (groupSize <= 0 || groupSize >= TOUR_MAX_VISITORS ||
+        (tourGuidePresent != 0 && tourGuidePresent != 1) || maxTours <= 0 ||
+        (GroupSize != TOUR_DYNAMIC && groupSize != GroupSize) || (Guide != TOUR_DYNAMIC && tourGuidePresent != Guide)) {
         throw std::invalid_argument("An error occurred.");
     }
 
-    this->groupSize = groupSize;
-    this->tourGuidePresent = tourGuidePresent;
-    this->totalVisitorsNeeded = groupSize + tourGuidePresent;
-    this->visitorsWaiting = 0;
-    this->visitorsLeaving = 0;
-    this->tourStarted = false;
-    this->guideThreadID = 0;
+    this->maxTours = maxTours;
+    this->maxWait = 0;
+    this->deadlinePolicy = TOUR_DEADLINE_LEAVE;
+    this->toursRunning = 0;
+    this->peakTours = 0;
+    this->toursStarted = 0;
+    this->mutexWaitMicros = 0;
+    this->partialTours = 0;
+    this->emptyPlaces = 0;
+    this->gateWaitMicros = 0;
+    this->toured = 0;
+    this->earlyLeaves = 0;
+    for (int i = 0; i < TOUR_HIST_BUCKETS; i++) {
+        waitHistogram[i].store(0, std::memory_order_relaxed);
+    }
+
+    // The first slot forms a group right away, the rest wait in the pool
+    slots = new TourSlot[maxTours];
+    freeSlots = NULL;
+    for (int i = maxTours - 1; i >= 0; i--) {
+        slots[i].state.store(0, std::memory_order_relaxed);
+        slots[i].next = freeSlots;
+        freeSlots = &slots[i];
+    }
+    forming.store(freeSlots, std::memory_order_relaxed);
+    freeSlots = freeSlots->next;
 
     sem_init(&mutex, 0, 1); // Mutex smeaphore starts unlocked
-    sem_init(&tourEnd, 0, 0); // Tour end semaphore starts locked
-    sem_init(&arrival, 0, 1); // Arrival semaphore starts unlocked
-
-    pthread_mutex_init(&printMutex, NULL);
 }
 
 // Destructor
-Tour::~Tour() {
+template <int GroupSize, int Guide>
+BasicTour<GroupSize, Guide>::~BasicTour() {
     sem_destroy(&mutex);
-    sem_destroy(&tourEnd);
-    sem_destroy(&arrival);
+    delete[] slots;
+}
 
-    pthread_mutex_destroy(&printMutex);
+// Deadline policy
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::setDeadline(long maxWaitMicros, TourDeadlinePolicy policy) {
+    maxWait = maxWaitMicros > 0 ? maxWaitMicros : 0;
+    deadlinePolicy = policy;
+}
+
+// Stamp the arrival time and deadline of visit
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::setArrival(TourVisit& visit, long maxWaitMicros) {
+    long wait = maxWaitMicros >= 0 ? maxWaitMicros : maxWait;
+    visit.arrivedAt = tourClock();
+    visit.deadline = visit.arrivedAt + wait;
+    visit.waitLimited = wait > 0;
+    visit.slot = NULL;
 }
 
 // Arrive method
-void Tour::arrive() {
-    pthread_t tid = pthread_self();
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::arrive(long maxWaitMicros) {
+    TourVisit& visit = currentVisit;
+    visit.id = pthread_self();
+    setArrival(visit, maxWaitMicros);
 
     // Print arrival message
-    pthread_mutex_lock(&printMutex);
-    printf("Thread ID: %lu | Status: Arrived at the location.\n", tid);
-    pthread_mutex_unlock(&printMutex);
+    tourLog(visit.log, TOUR_LOG_ARRIVED, visit.id);
+
+    // Wait for a free place in the forming group, the gate admits nobody
+    // while every slot is touring since all places are taken
+    unsigned ticket = arrival.draw();
+    if (!visit.waitLimited) {
+        arrival.wait(ticket);
+    } else if (!arrival.wait(ticket, visit.deadline) && arrival.giveUp(ticket)) {
+        leaveGate(visit);
+        return;
+    }
 
-    // Wait to enter if arrivals are blocked
-    sem_wait(&arrival);
-    sem_post(&arrival); // Allow others to check arrival status
+    join(visit);
 
-    // Enter critical section
-    sem_wait(&mutex);
+    // Wait for the tour to start, up to the deadline
+    for (;;) {
+        TourArriveStep step = arriveStep(visit);
+        if (step == TOUR_ARRIVE_WAIT_UNTIL) {
+            visit.slot->tourStart.wait(visit.startGeneration, visit.deadline);
+        } else if (step == TOUR_ARRIVE_WAIT) {
+            visit.slot->tourStart.wait(visit.startGeneration);
+        } else {
+            break;
+        }
+    }
+}
 
-    // Increment visitors waiting
-    visitorsWaiting++;
+// The deadline passed at the gate, the ticket was given up
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::leaveGate(TourVisit& visit) {
+    gateWaitMicros.fetch_add(tourClock() - visit.arrivedAt, std::memory_order_relaxed);
+    earlyLeaves.fetch_add(1, std::memory_order_relaxed);
 
-    int currentVisitors = visitorsWaiting;
+    // Print leaving message
+    tourLog(visit.log, TOUR_LOG_CAMERA_FULL, visit.id);
+}
 
-    if (!tourStarted && visitorsWaiting == totalVisitorsNeeded) {
-        // Assign guide if required
-        if (tourGuidePresent == 1 && guideThreadID == 0) {
-            guideThreadID = tid;
+// Join the forming group once admitted
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::join(TourVisit& visit) {
+    unsigned long tid = visit.id;
+    long now = tourClock();
+    gateWaitMicros.fetch_add(now - visit.arrivedAt, std::memory_order_relaxed);
+
+    // The forming slot cannot change under us, it only starts once every
+    // admitted visitor joined
+    TourSlot* slot = forming.load(std::memory_order_acquire);
+
+    // Read before joining, the group cannot start or end without us
+    visit.slot = slot;
+    visit.startGeneration = slot->tourStart.current();
+    visit.endGeneration = slot->tourEnd.current();
+
+    // Join the group, the visitor completing it starts the tour in the same
+    // step. After a deadline start the group is complete short of its shortfall.
+    uint64_t state = slot->state.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        next = state + TOUR_WAITING_ONE;
+        if (tourWaiting(next) == totalVisitorsNeeded() - tourShortfall(next)) {
+            next |= TOUR_STARTED;
         }
+    } while (!slot->state.compare_exchange_weak(state, next, std::memory_order_acq_rel, std::memory_order_relaxed));
 
-        // Print tour starting message
-        pthread_mutex_lock(&printMutex);
-        printf("Thread ID: %lu | Status: There are enough visitors, the tour is starting.\n", tid);
-        pthread_mutex_unlock(&printMutex);
-
-        // Set tour as started
-        tourStarted = true;
-
-        // Block new arrivals
-        sem_wait(&arrival); // Decrease arrival semaphore to 0
+    int currentVisitors = tourWaiting(next);
+    visit.guide = false;
 
-        sem_post(&mutex);
+    if (next & TOUR_STARTED) {
+        beginTour(visit, slot, now);
     } else {
         // Not enough visitors yet
-        sem_post(&mutex);
 
         // Print solo shots message
-        pthread_mutex_lock(&printMutex);
-        printf("Thread ID: %lu | Status: Only %d visitors inside, starting solo shots.\n", tid, currentVisitors);
-        pthread_mutex_unlock(&printMutex);
+        tourLog(visit.log, TOUR_LOG_SOLO_SHOTS, tid, currentVisitors);
 
-        // Proceed to start() without waiting
+        // Proceed to start(), after waiting in arrive() if there is a deadline
     }
 }
 
-// Leave method
-void Tour::leave() {
-    pthread_t tid = pthread_self();
+// Start the tour of slot, visit completed its group
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::beginTour(TourVisit& visit, TourSlot* slot, long now) {
+    // Assign guide if required
+    visit.guide = tourGuidePresent() == 1;
+
+    // Print tour starting message
+    tourLog(visit.log, TOUR_LOG_STARTING, visit.id);
+    slot->startedAt = now;
 
+    // Members waiting in arrive() go on to start()
+    slot->tourStart.release();
+
+    // Without a guide the others may leave once the start is announced
+    if (tourGuidePresent() == 0) {
+        slot->tourEnd.release();
+    }
+
+    startTour();
+}
+
+// Take mutex, timing the wait if it is held. A virtual clock stands still
+// while the thread blocks, so the wait is real time.
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::lock() {
+    if (sem_trywait(&mutex) == 0) {
+        return;
+    }
+    long begin = tourMonotonicMicros();
     sem_wait(&mutex);
+    mutexWaitMicros += tourMonotonicMicros() - begin;
+}
 
-    if (!tourStarted) {
-        // Tour has not started, visitor leaves
-        visitorsWaiting--;
-        sem_post(&mutex);
+// Bookkeeping once per tour, the next group forms in a free slot right away if there is one
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::startTour() {
+    lock();
+    toursStarted++;
+    toursRunning++;
+    if (toursRunning > peakTours) {
+        peakTours = toursRunning;
+    }
 
-        // Print leaving message
-        pthread_mutex_lock(&printMutex);
-        printf("Thread ID: %lu | Status: My camera ran out of memory while waiting, I am leaving.\n", tid);
-        pthread_mutex_unlock(&printMutex);
+    TourSlot* slot = freeSlots;
+    if (slot != NULL) {
+        freeSlots = slot->next;
+    }
+    forming.store(slot, std::memory_order_release);
+    if (slot != NULL) {
+        arrival.admit(totalVisitorsNeeded());
+    }
+    sem_post(&mutex);
+}
 
+// Return a finished slot, it forms the next group if all slots were touring
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::recycleSlot(TourSlot* slot) {
+    lock();
+    toursRunning--;
+    if (forming.load(std::memory_order_relaxed) == NULL) {
+        forming.store(slot, std::memory_order_release);
+        arrival.admit(totalVisitorsNeeded());
     } else {
-        sem_post(&mutex);
+        slot->next = freeSlots;
+        freeSlots = slot;
+    }
+    sem_post(&mutex);
+}
+
+// Leave method
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::leave() {
+    TourVisit& visit = currentVisit;
+
+    TourLeaveStep step = leaveStep(visit);
+    if (step == TOUR_LEAVE_WAIT) {
+        visit.slot->tourEnd.wait(visit.endGeneration);
+    }
+    if (step != TOUR_LEAVE_LEFT) {
+        finishVisit(visit);
+    }
+
+    // Our lines must be out before the visitor moves on
+    tourLogSync(visit.log);
+}
+
+// Decide what visit does next in arrive() once it joined, taking the deadline action once it passed
+template <int GroupSize, int Guide>
+TourArriveStep BasicTour<GroupSize, Guide>::arriveStep(TourVisit& visit) {
+    // Without a maximum wait only an early start waits here
+    if (!visit.waitLimited && deadlinePolicy != TOUR_DEADLINE_START_EARLY) {
+        return TOUR_ARRIVE_DONE;
+    }
+
+    TourSlot* slot = visit.slot;
+    for (;;) {
+        uint64_t state = slot->state.load(std::memory_order_acquire);
+        if (state & TOUR_STARTED) {
+            return TOUR_ARRIVE_DONE;
+        }
 
-        if (tourGuidePresent == 1 && pthread_equal(tid, guideThreadID)) {
-            // This is the guide
-            // Guide announces tour is over
-            pthread_mutex_lock(&printMutex);
-            printf("Thread ID: %lu | Status: Tour guide speaking, the tour is over.\n", tid);
-            pthread_mutex_unlock(&printMutex);
+        // A deadline start only waits for admitted visitors still joining
+        if (tourShortfall(state) > 0) {
+            return TOUR_ARRIVE_WAIT;
+        }
+        if (tourClock() < visit.deadline) {
+            return TOUR_ARRIVE_WAIT_UNTIL;
+        }
 
-            // Release visitors waiting on tourEnd
-            for (int i = 0; i < totalVisitorsNeeded - 1; i++) {
-                sem_post(&tourEnd);
+        if (deadlinePolicy == TOUR_DEADLINE_START_EARLY) {
+            startEarly(visit);
+            if (!(slot->state.load(std::memory_order_acquire) & TOUR_STARTED)) {
+                return TOUR_ARRIVE_WAIT;
             }
-        } else {
-            // Wait for tour end if guide is present
-            if (tourGuidePresent == 1) {
-                sem_wait(&tourEnd);
+        } else if (leaveBeforeStart(visit)) {
+            return TOUR_ARRIVE_LEFT;
+        }
+    }
+}
+
+// Decide what visit does next in leave()
+template <int GroupSize, int Guide>
+TourLeaveStep BasicTour<GroupSize, Guide>::leaveStep(TourVisit& visit) {
+    TourSlot* slot = visit.slot;
+    if (slot == NULL) {
+        // Left in arrive() already
+        return TOUR_LEAVE_LEFT;
+    }
+    for (;;) {
+        uint64_t state = slot->state.load(std::memory_order_acquire);
+        if (state & TOUR_STARTED) {
+            // Wait for tour end if guide is present, or else for the start announcement
+            if ((tourGuidePresent() == 1 && visit.guide) || slot->tourEnd.current() != visit.endGeneration) {
+                return TOUR_LEAVE_DONE;
             }
+            return TOUR_LEAVE_WAIT;
+        }
 
-            // Print visitor leaving message
-            pthread_mutex_lock(&printMutex);
-            printf("Thread ID: %lu | Status: I am a visitor and I am leaving.\n", tid);
-            pthread_mutex_unlock(&printMutex);
+        // Not started, only visitors who did not wait in arrive() get here
+        if (leaveBeforeStart(visit)) {
+            return TOUR_LEAVE_LEFT;
         }
+    }
+}
 
-        sem_wait(&mutex);
-        visitorsLeaving++;
+// The deadline of a visitor in the forming group passed: close the group at
+// its current size. Places nobody took yet are withdrawn from the gate, the
+// tour starts right away, or once the admitted visitors still on their way joined.
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::startEarly(TourVisit& visit) {
+    TourSlot* slot = visit.slot;
+
+    // Under mutex the slot cannot be replaced, so unclaimed places are its own
+    lock();
+    uint64_t state = slot->state.load(std::memory_order_acquire);
+    unsigned withdrawn = (state & TOUR_STARTED) ? 0 : arrival.withdraw();
+    if (withdrawn == 0) {
+        // Started already, or the admitted visitors joining fill the group
+        sem_post(&mutex);
+        return;
+    }
 
-        if (visitorsLeaving == totalVisitorsNeeded) {
-            // Last visitor
-            // Print message
-            pthread_mutex_lock(&printMutex);
-            printf("Thread ID: %lu | Status: All visitors have left, the new visitors can come.\n", tid);
-            pthread_mutex_unlock(&printMutex);
+    uint64_t next;
+    do {
+        next = state + withdrawn * TOUR_SHORTFALL_ONE;
+        if (tourWaiting(next) == totalVisitorsNeeded() - tourShortfall(next)) {
+            next |= TOUR_STARTED;
+        }
+    } while (!slot->state.compare_exchange_weak(state, next, std::memory_order_acq_rel, std::memory_order_acquire));
 
-            // Reset state
-            visitorsWaiting = 0;
-            visitorsLeaving = 0;
-            tourStarted = false;
-            guideThreadID = 0;
+    if (tourShortfall(state) == 0) {
+        partialTours++;
+    }
+    emptyPlaces += withdrawn;
+    sem_post(&mutex);
 
-            // Allow new arrivals
-            sem_post(&arrival); // Increase arrival to 1
+    if (next & TOUR_STARTED) {
+        beginTour(visit, slot, tourClock());
+    }
+}
+
+// Leave the group unless its tour started in the meantime, returns true if we left
+template <int GroupSize, int Guide>
+bool BasicTour<GroupSize, Guide>::leaveBeforeStart(TourVisit& visit) {
+    TourSlot* slot = visit.slot;
+    uint64_t state = slot->state.load(std::memory_order_acquire);
+    while (!(state & TOUR_STARTED)) {
+        if (slot->state.compare_exchange_weak(state, state - TOUR_WAITING_ONE,
+                                              std::memory_order_acq_rel, std::memory_order_acquire)) {
+            // Tour has not started, visitor leaves and frees its place
+            visit.slot = NULL;
+            arrival.admit(1);
+            earlyLeaves.fetch_add(1, std::memory_order_relaxed);
+
+            // Print leaving message
+            tourLog(visit.log, TOUR_LOG_CAMERA_FULL, visit.id);
+            return true;
         }
+    }
+    return false;
+}
 
-        sem_post(&mutex);
+// Leave a tour that has ended for us, the last one out recycles the slot
+template <int GroupSize, int Guide>
+void BasicTour<GroupSize, Guide>::finishVisit(TourVisit& visit) {
+    unsigned long tid = visit.id;
+    TourSlot* slot = visit.slot;
+
+    // The start time was written before tourEnd released us
+    toured.fetch_add(1, std::memory_order_relaxed);
+    waitHistogram[tourHistBucket(slot->startedAt - visit.arrivedAt)].fetch_add(1, std::memory_order_relaxed);
+
+    if (tourGuidePresent() == 1 && visit.guide) {
+        // This is the guide
+        // Guide announces tour is over
+        tourLog(visit.log, TOUR_LOG_GUIDE_OVER, tid);
+
+        // Release all visitors waiting on tourEnd at once
+        slot->tourEnd.release();
+    } else {
+        // Print visitor leaving message
+        tourLog(visit.log, TOUR_LOG_VISITOR_LEAVING, tid);
+    }
+
+    uint64_t state = slot->state.fetch_add(TOUR_LEFT_ONE, std::memory_order_acq_rel);
+    if (tourLeft(state) + 1 == totalVisitorsNeeded() - tourShortfall(state)) {
+        // Last visitor
+        // Print message
+        tourLog(visit.log, TOUR_LOG_ALL_LEFT, tid);
+
+        // Reset state, every other member already left. Only the generation survives.
+        uint64_t generation = (state & ~(TOUR_GENERATION_ONE - 1)) + TOUR_GENERATION_ONE;
+        slot->state.store(generation, std::memory_order_release);
+
+        recycleSlot(slot);
+    }
+}
+
+// Stats method
+template <int GroupSize, int Guide>
+TourStats BasicTour<GroupSize, Guide>::stats() const {
+    TourStats s;
+    s.tours = toursStarted;
+    s.peakTours = peakTours;
+    s.gateWaits = arrival.waitCount();
+    s.gateWakeups = arrival.wakeupCount();
+    s.endWakeups = 0;
+    for (int i = 0; i < maxTours; i++) {
+        s.endWakeups += slots[i].tourEnd.wakeupCount();
+    }
+    s.gateWaitMicros = gateWaitMicros.load();
+    s.mutexWaitMicros = mutexWaitMicros;
+    s.toured = toured.load();
+    s.partialTours = partialTours;
+    s.emptyPlaces = emptyPlaces;
+    s.earlyLeaves = earlyLeaves.load();
+    for (int i = 0; i < TOUR_HIST_BUCKETS; i++) {
+        s.waitHistogram[i] = waitHistogram[i].load(std::memory_order_relaxed);
     }
+    return s;
 }
 #endif // TOUR_H
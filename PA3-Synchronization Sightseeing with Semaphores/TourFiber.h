@@ -0,0 +1,439 @@
+#ifndef TOUR_FIBER_H
+#define TOUR_FIBER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "Tour.h"
+
+// Coroutine mode for Tour. Every visitor is a FiberTask multiplexed on a
+// small pool of worker threads. A visitor waiting at the gate or for the
+// end of its tour is parked as a TourWaiter and rescheduled by the thread
+// that ends the wait, so no worker ever sleeps on a visitor's behalf.
+// With virtual time the runtime jumps the clock to the next timer whenever
+// every worker is idle, so long sleeps cost nothing. Needs -std=c++20.
+
+class FiberRuntime;
+
+// Fire and forget coroutine, runs once spawned and frees itself at the end
+struct FiberTask {
+    struct promise_type {
+        FiberTask get_return_object() {
+            return FiberTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+        ~promise_type();
+
+        // Count frame memory for the memory per visitor report
+        static void* operator new(size_t size) {
+            frameBytes.fetch_add(size, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+        static void operator delete(void* frame, size_t size) {
+            frameBytes.fetch_sub(size, std::memory_order_relaxed);
+            ::operator delete(frame);
+        }
+
+        static inline std::atomic<size_t> frameBytes{0};
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+class FiberRuntime {
+public:
+    // With virtualTime tourClock() follows the runtime's clock until it is destroyed
+    explicit FiberRuntime(int workers, bool virtualTime = false)
+        : workers(workers), virtualTime(virtualTime), idle(0), live(0), timerSequence(0), peakFrameBytes(0) {
+        if (virtualTime) {
+            virtualNow.store(0);
+            tourClock = &FiberRuntime::virtualClock;
+        }
+    }
+
+    ~FiberRuntime() {
+        if (virtualTime) {
+            tourClock = tourMonotonicMicros;
+        }
+    }
+
+    // Queue a new fiber, it starts once run() is called
+    void spawn(FiberTask task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        live++;
+        ready.push_back(task.handle);
+    }
+
+    // Run until every fiber finished and its status lines are written
+    void run() {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < workers; i++) {
+            threads.emplace_back(&FiberRuntime::workerLoop, this);
+        }
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+        // Fibers leave without waiting for their status lines
+        tourLogSyncAll();
+    }
+
+    void schedule(std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(handle);
+        }
+        wakeup.notify_one();
+    }
+
+    // Resume handle once tourClock() reaches when, in microseconds
+    void scheduleAt(long when, std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            timers.push(Timer{when, timerSequence++, handle, nullptr});
+        }
+        wakeup.notify_one();
+    }
+
+    // Run callback on a worker once tourClock() reaches when, it must not block
+    void callAt(long when, std::function<void()> callback) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            timers.push(Timer{when, timerSequence++, nullptr, callback});
+        }
+        wakeup.notify_one();
+    }
+
+    void fiberFinished() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--live == 0) {
+            wakeup.notify_all();
+        }
+    }
+
+    size_t peakFrames() const { return peakFrameBytes; }
+
+    // Runtime of the calling worker thread
+    static inline thread_local FiberRuntime* current = NULL;
+
+private:
+    struct Timer {
+        long when;
+        unsigned long sequence;     // Keeps timers of the same instant in order
+        std::coroutine_handle<> handle;
+        std::function<void()> callback; // Run instead of resuming handle if set
+        bool operator>(const Timer& other) const {
+            return when != other.when ? when > other.when : sequence > other.sequence;
+        }
+    };
+
+    static long virtualClock() { return virtualNow.load(std::memory_order_acquire); }
+
+    void workerLoop() {
+        current = this;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            // Nothing can run before the next timer once the other workers
+            // are idle too, so virtual time moves on to it
+            if (virtualTime && ready.empty() && !timers.empty() && idle == workers - 1) {
+                if (timers.top().when > virtualNow.load(std::memory_order_relaxed)) {
+                    virtualNow.store(timers.top().when, std::memory_order_release);
+                }
+            }
+
+            // Move due timers to the ready queue, callbacks run outside the lock
+            long now = tourClock();
+            size_t due = 0;
+            std::vector<std::function<void()> > callbacks;
+            while (!timers.empty() && timers.top().when <= now) {
+                if (timers.top().callback) {
+                    callbacks.push_back(timers.top().callback);
+                } else {
+                    ready.push_back(timers.top().handle);
+                    due++;
+                }
+                timers.pop();
+            }
+            if (due > 1) {
+                wakeup.notify_all();
+            }
+            if (!callbacks.empty()) {
+                lock.unlock();
+                for (size_t i = 0; i < callbacks.size(); i++) {
+                    callbacks[i]();
+                }
+                lock.lock();
+                continue;
+            }
+
+            if (!ready.empty()) {
+                std::coroutine_handle<> handle = ready.front();
+                ready.pop_front();
+                size_t frames = FiberTask::promise_type::frameBytes.load(std::memory_order_relaxed);
+                if (frames > peakFrameBytes) {
+                    peakFrameBytes = frames;
+                }
+                lock.unlock();
+                handle.resume();
+                lock.lock();
+            } else if (live == 0) {
+                break;
+            } else if (!timers.empty() && !virtualTime) {
+                wakeup.wait_for(lock, std::chrono::microseconds(timers.top().when - now));
+            } else {
+                idle++;
+                wakeup.wait(lock);
+                idle--;
+            }
+        }
+        wakeup.notify_all();
+        current = NULL;
+    }
+
+    int workers;
+    bool virtualTime;
+    int idle;                   // Workers waiting for work
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<std::coroutine_handle<> > ready;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > timers;
+    long live;                  // Fibers spawned and not finished
+    unsigned long timerSequence;
+    size_t peakFrameBytes;      // Most coroutine frame memory seen at once
+
+    static inline std::atomic<long> virtualNow{0}; // Virtual microseconds since the runtime started
+};
+
+inline FiberTask::promise_type::~promise_type() {
+    FiberRuntime::current->fiberFinished();
+}
+
+// co_await FiberSleep(micros) suspends the fiber for micros microseconds of tourClock()
+class FiberSleep {
+public:
+    explicit FiberSleep(long micros) : micros(micros) {}
+
+    bool await_ready() const { return micros <= 0; }
+    void await_suspend(std::coroutine_handle<> handle) {
+        FiberRuntime::current->scheduleAt(tourClock() + micros, handle);
+    }
+    void await_resume() {}
+
+private:
+    long micros;
+};
+
+// Base of the Tour awaiters, parks the coroutine as a TourWaiter
+class TourFiberWaiter : public TourWaiter {
+protected:
+    TourFiberWaiter() {
+        wake = &TourFiberWaiter::resumeWaiter;
+        key = 0;
+        next = NULL;
+        runtime = NULL;
+    }
+
+    void prepare(std::coroutine_handle<> handle) {
+        this->handle = handle;
+        runtime = FiberRuntime::current;
+    }
+
+    static void resumeWaiter(TourWaiter* waiter) {
+        TourFiberWaiter* self = static_cast<TourFiberWaiter*>(waiter);
+        self->runtime->schedule(self->handle);
+    }
+
+    std::coroutine_handle<> handle;
+    FiberRuntime* runtime;
+};
+
+// co_await tour.arriveAsync(visit), T is the BasicTour. Waits at the gate
+// and then in the forming group up to the visitor's deadline.
+template <class T>
+class TourArriveAwaiter : public TourFiberWaiter {
+public:
+    TourArriveAwaiter(T& tour, TourVisit& visit, long maxWaitMicros)
+        : tour(tour), visit(visit), maxWaitMicros(maxWaitMicros), atGate(false), step(TOUR_ARRIVE_DONE) {}
+
+    bool await_ready() {
+        tour.setArrival(visit, maxWaitMicros);
+        // Print arrival message
+        tourLog(visit.log, TOUR_LOG_ARRIVED, visit.id);
+        key = tour.arrival.draw();
+        atGate = !tour.arrival.admitted(key);
+        return !atGate && joined();
+    }
+    bool await_suspend(std::coroutine_handle<> handle) {
+        prepare(handle);
+        return atGate ? parkAtGate() : suspend();
+    }
+    void await_resume() {
+        // Admitted without a wait for the start to follow
+        if (atGate) {
+            tour.join(visit);
+        }
+    }
+
+private:
+    // Parked until the deadline, at the gate or on tourStart. The timer holds
+    // it too, so a timer firing after the fiber went on finds it no longer parked.
+    struct DeadlineWaiter : public TourWaiter {
+        DeadlineWaiter(TourArriveAwaiter* awaiter, void (*wakeFn)(TourWaiter*), unsigned key) : awaiter(awaiter) {
+            wake = wakeFn;
+            this->key = key;
+            next = NULL;
+        }
+
+        static void admittedWaiter(TourWaiter* waiter) {
+            static_cast<DeadlineWaiter*>(waiter)->awaiter->admitted();
+        }
+        static void startedWaiter(TourWaiter* waiter) {
+            TourArriveAwaiter* awaiter = static_cast<DeadlineWaiter*>(waiter)->awaiter;
+            awaiter->runtime->schedule(awaiter->handle);
+        }
+
+        // Still parked means the fiber still waits and nobody else resumes it
+        void expireAtGate() {
+            if (awaiter->tour.arrival.giveUp(this)) {
+                awaiter->atGate = false;
+                awaiter->tour.leaveGate(awaiter->visit);
+                awaiter->runtime->schedule(awaiter->handle);
+            }
+        }
+        void expire() {
+            if (awaiter->visit.slot->tourStart.cancel(this)) {
+                awaiter->deadlinePassed();
+            }
+        }
+
+        TourArriveAwaiter* awaiter;
+    };
+
+    // Join the group, returns true if the visitor goes on without waiting for the start
+    bool joined() {
+        tour.join(visit);
+        step = tour.arriveStep(visit);
+        return step == TOUR_ARRIVE_DONE || step == TOUR_ARRIVE_LEFT;
+    }
+
+    // Park at the gate, returns false if the ticket was admitted meanwhile
+    // and the fiber goes on
+    bool parkAtGate() {
+        bool waitsForStart = visit.waitLimited || tour.deadlinePolicy == TOUR_DEADLINE_START_EARLY;
+        if (!waitsForStart) {
+            // resumeWaiter, await_resume joins
+            if (tour.arrival.park(this)) {
+                return true;
+            }
+        } else if (!visit.waitLimited) {
+            wake = &TourArriveAwaiter::admittedWaiter;
+            if (tour.arrival.park(this)) {
+                return true;
+            }
+        } else {
+            std::shared_ptr<DeadlineWaiter> waiter =
+                std::make_shared<DeadlineWaiter>(this, &DeadlineWaiter::admittedWaiter, key);
+            if (tour.arrival.park(waiter.get())) {
+                runtime->callAt(visit.deadline, [waiter]() { waiter->expireAtGate(); });
+                return true;
+            }
+        }
+        atGate = false;
+        return !joined() && suspend();
+    }
+
+    static void admittedWaiter(TourWaiter* waiter) {
+        static_cast<TourArriveAwaiter*>(waiter)->admitted();
+    }
+
+    // The gate admitted the parked visitor. admit() may run under the tour
+    // mutex, which join() takes, so joining moves to a worker.
+    void admitted() {
+        atGate = false;
+        runtime->callAt(0, [this]() {
+            if (joined() || !suspend()) {
+                runtime->schedule(handle);
+            }
+        });
+    }
+
+    // Park on tourStart for step, returns false if the wait is already over
+    bool suspend() {
+        TourSlot* slot = visit.slot;
+        if (step == TOUR_ARRIVE_WAIT) {
+            wake = &TourFiberWaiter::resumeWaiter;
+            return slot->tourStart.park(this, visit.startGeneration);
+        }
+        std::shared_ptr<DeadlineWaiter> waiter =
+            std::make_shared<DeadlineWaiter>(this, &DeadlineWaiter::startedWaiter, visit.startGeneration);
+        if (!slot->tourStart.park(waiter.get(), visit.startGeneration)) {
+            return false;
+        }
+        runtime->callAt(visit.deadline, [waiter]() { waiter->expire(); });
+        return true;
+    }
+
+    void deadlinePassed() {
+        step = tour.arriveStep(visit);
+        if (step == TOUR_ARRIVE_DONE || step == TOUR_ARRIVE_LEFT || !suspend()) {
+            runtime->schedule(handle);
+        }
+    }
+
+    T& tour;
+    TourVisit& visit;
+    long maxWaitMicros;
+    bool atGate;                // Resumed from the gate without joining yet
+    TourArriveStep step;
+};
+
+// co_await tour.leaveAsync(visit), T is the BasicTour
+template <class T>
+class TourLeaveAwaiter : public TourFiberWaiter {
+public:
+    TourLeaveAwaiter(T& tour, TourVisit& visit) : tour(tour), visit(visit), step(TOUR_LEAVE_DONE) {}
+
+    bool await_ready() {
+        step = tour.leaveStep(visit);
+        return step == TOUR_LEAVE_LEFT || step == TOUR_LEAVE_DONE;
+    }
+    bool await_suspend(std::coroutine_handle<> handle) {
+        prepare(handle);
+        return visit.slot->tourEnd.park(this, visit.endGeneration);
+    }
+    void await_resume() {
+        if (step != TOUR_LEAVE_LEFT) {
+            tour.finishVisit(visit);
+        }
+        // Waiting for the lines could put the worker to sleep, the flusher
+        // writes them and run() waits for the rest
+        tourLogFlush(visit.log);
+    }
+
+private:
+    T& tour;
+    TourVisit& visit;
+    TourLeaveStep step;
+};
+
+template <int GroupSize, int Guide>
+TourArriveAwaiter<BasicTour<GroupSize, Guide> > BasicTour<GroupSize, Guide>::arriveAsync(TourVisit& visit, long maxWaitMicros) {
+    return TourArriveAwaiter<BasicTour>(*this, visit, maxWaitMicros);
+}
+
+template <int GroupSize, int Guide>
+TourLeaveAwaiter<BasicTour<GroupSize, Guide> > BasicTour<GroupSize, Guide>::leaveAsync(TourVisit& visit) {
+    return TourLeaveAwaiter<BasicTour>(*this, visit);
+}
+
+#endif // TOUR_FIBER_H
@@ -0,0 +1,260 @@
+#ifndef TOUR_LOG_H
+#define TOUR_LOG_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "TourSync.h"
+
+// Status lines of the tour. Visitors put a small record into a lock-free
+// ring, formatting and writing happens later in batches, so nobody holds
+// a lock around printf. Records of one visitor keep their order. Each visit
+// carries a TourLogCursor, tourLogSync() waits until its lines are written
+// and tourLogFlush() only hands them to the background thread, for fibers
+// that may not block their worker. Compile with -DTOUR_NO_LOG to drop
+// logging entirely.
+
+enum TourLogStatus {
+    TOUR_LOG_ARRIVED,
+    TOUR_LOG_SOLO_SHOTS,
+    TOUR_LOG_STARTING,
+    TOUR_LOG_CAMERA_FULL,
+    TOUR_LOG_GUIDE_OVER,
+    TOUR_LOG_VISITOR_LEAVING,
+    TOUR_LOG_ALL_LEFT
+};
+
+// Last record of one visitor. It travels with the visit rather than the
+// thread, since a fiber may resume on another worker.
+struct TourLogCursor {
+    unsigned long last = 0;
+    bool pending = false;       // last not known to be written yet
+};
+
+#ifdef TOUR_NO_LOG
+
+static inline void tourLog(TourLogCursor&, TourLogStatus, pthread_t, int = 0) {}
+static inline void tourLogSync(TourLogCursor&) {}
+static inline void tourLogFlush(TourLogCursor&) {}
+static inline void tourLogSyncAll() {}
+
+#else
+
+#define TOUR_LOG_SIZE 4096      // Records in the ring, must be a power of two
+#define TOUR_LOG_BATCH 65536    // Bytes formatted before each write
+#define TOUR_LOG_FLUSH_MS 10    // Background flush interval while records are pending, idle otherwise
+
+struct TourLogRecord {
+    std::atomic<unsigned long> sequence; // Position the record is ready for, see TourLogRing
+    pthread_t tid;
+    int status;
+    int count;                  // Visitors inside, for TOUR_LOG_SOLO_SHOTS
+};
+
+// Bounded multi-producer ring. A record whose sequence equals the enqueue
+// position is free, position + 1 means written and ready, the consumer then
+// hands it to position + TOUR_LOG_SIZE. Only one thread consumes at a time:
+// a thread in sync() drains the ring itself when nobody else is, and a
+// background thread woken by flush() or a half full ring writes the records,
+// then keeps flushing every TOUR_LOG_FLUSH_MS until none are pending.
+class TourLogRing {
+public:
+    TourLogRing() : head(0), tail(0), draining(0), written(0), drains(0), syncWaiters(0), flusherSleeping(0) {
+        for (unsigned long i = 0; i < TOUR_LOG_SIZE; i++) {
+            records[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        pthread_t flusher;
+        if (pthread_create(&flusher, NULL, &TourLogRing::flusherLoop, this) != 0) {
+            perror("tour log");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(flusher);
+    }
+
+    // Append a record, waits for a consumer instead of dropping when full
+    unsigned long push(TourLogStatus status, pthread_t tid, int count) {
+        unsigned long pos = head.load(std::memory_order_relaxed);
+        TourLogRecord* record;
+        for (;;) {
+            record = &records[pos & (TOUR_LOG_SIZE - 1)];
+            long diff = (long) (record->sequence.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                if (!tryDrain()) {
+                    sched_yield();
+                }
+                pos = head.load(std::memory_order_relaxed);
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        record->tid = tid;
+        record->status = status;
+        record->count = count;
+        record->sequence.store(pos + 1, std::memory_order_release);
+
+        // Let the background thread catch up before producers run into a full ring
+        if ((unsigned) pos - written.load(std::memory_order_relaxed) == TOUR_LOG_SIZE / 2) {
+            wakeFlusher();
+        }
+        return pos;
+    }
+
+    // Wait until the record at pos reached stdout
+    void sync(unsigned long pos) {
+        unsigned target = (unsigned) (pos + 1);
+        for (;;) {
+            unsigned epoch = drains.load();
+            if ((int) (written.load() - target) >= 0) {
+                return;
+            }
+            if (tryDrain()) {
+                continue;
+            }
+            // Someone else is draining, wait for them to finish
+            syncWaiters.fetch_add(1);
+            futexWait(&drains, epoch);
+            syncWaiters.fetch_sub(1);
+        }
+    }
+
+    // Wait until every record pushed so far reached stdout
+    void syncAll() {
+        unsigned long pos = head.load();
+        if (pos > 0) {
+            sync(pos - 1);
+        }
+    }
+
+    // Have the background thread write the pending records soon, never blocks
+    void flush() {
+        // Our push before the flusher's idle check, or its sleep before our look
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wakeFlusher();
+    }
+
+private:
+    void wakeFlusher() {
+        if (flusherSleeping.load() == 1 && flusherSleeping.exchange(0) == 1) {
+            futexWake(&flusherSleeping, 1);
+        }
+    }
+
+    // Write every ready record if no other thread is consuming, returns false if one is
+    bool tryDrain() {
+        if (draining.load(std::memory_order_relaxed) || draining.exchange(1, std::memory_order_acquire)) {
+            return false;
+        }
+        size_t length;
+        while ((length = format()) > 0) {
+            fwrite(buffer, 1, length, stdout);
+            fflush(stdout);
+            written.store((unsigned) tail, std::memory_order_release);
+        }
+        draining.store(0, std::memory_order_release);
+
+        // Waiters recheck after every drain, even one that found nothing new
+        drains.fetch_add(1);
+        if (syncWaiters.load() > 0) {
+            futexWake(&drains, INT_MAX);
+        }
+        return true;
+    }
+
+    // Format ready records into buffer, returns the number of bytes
+    size_t format() {
+        static const char* const messages[] = {
+            "Arrived at the location.",
+            NULL,
+            "There are enough visitors, the tour is starting.",
+            "My camera ran out of memory while waiting, I am leaving.",
+            "Tour guide speaking, the tour is over.",
+            "I am a visitor and I am leaving.",
+            "All visitors have left, the new visitors can come."
+        };
+
+        size_t length = 0;
+        while (length + 256 < TOUR_LOG_BATCH) {
+            TourLogRecord* record = &records[tail & (TOUR_LOG_SIZE - 1)];
+            if (record->sequence.load(std::memory_order_acquire) != tail + 1) {
+                break;
+            }
+            if (record->status == TOUR_LOG_SOLO_SHOTS) {
+                length += sprintf(buffer + length, "Thread ID: %lu | Status: Only %d visitors inside, starting solo shots.\n",
+                                  record->tid, record->count);
+            } else {
+                length += sprintf(buffer + length, "Thread ID: %lu | Status: %s\n", record->tid, messages[record->status]);
+            }
+            record->sequence.store(tail + TOUR_LOG_SIZE, std::memory_order_release);
+            tail++;
+        }
+        return length;
+    }
+
+    static void* flusherLoop(void* arg) {
+        TourLogRing* ring = (TourLogRing*) arg;
+        struct timespec interval = { 0, TOUR_LOG_FLUSH_MS * 1000000L };
+        for (;;) {
+            // Nothing pending, sleep until flush() or a filling ring wakes us.
+            // Announced before looking, so a flush() after the check wakes us.
+            ring->flusherSleeping.store(1);
+            bool pending = (unsigned) ring->head.load() != ring->written.load();
+            futexWait(&ring->flusherSleeping, 1, pending ? &interval : NULL);
+            ring->flusherSleeping.store(0);
+            if ((unsigned) ring->head.load(std::memory_order_relaxed) != ring->written.load(std::memory_order_relaxed)) {
+                ring->tryDrain();
+            }
+        }
+        return NULL;
+    }
+
+    alignas(CACHE_LINE) std::atomic<unsigned long> head;    // Next position to enqueue
+    alignas(CACHE_LINE) unsigned long tail;                 // Next position to write, owned by the drainer
+    std::atomic<int> draining;                              // 1 while a thread consumes
+    char buffer[TOUR_LOG_BATCH];                            // Owned by the drainer
+    alignas(CACHE_LINE) std::atomic<unsigned> written;      // Positions below this are on stdout
+    std::atomic<unsigned> drains;                           // Finished drains, sync() sleeps on it
+    std::atomic<int> syncWaiters;
+    alignas(CACHE_LINE) std::atomic<unsigned> flusherSleeping;
+    alignas(CACHE_LINE) TourLogRecord records[TOUR_LOG_SIZE];
+};
+
+// The ring lives as long as the process, the detached flusher keeps using it
+static inline TourLogRing* tourLogRing() {
+    static TourLogRing* ring = new TourLogRing();
+    return ring;
+}
+
+static inline void tourLog(TourLogCursor& cursor, TourLogStatus status, pthread_t tid, int count = 0) {
+    cursor.last = tourLogRing()->push(status, tid, count);
+    cursor.pending = true;
+}
+
+// Wait until the lines of cursor are written, may sleep on another thread's drain
+static inline void tourLogSync(TourLogCursor& cursor) {
+    if (cursor.pending) {
+        tourLogRing()->sync(cursor.last);
+        cursor.pending = false;
+    }
+}
+
+// Hand the lines of cursor to the background thread without waiting
+static inline void tourLogFlush(TourLogCursor& cursor) {
+    if (cursor.pending) {
+        tourLogRing()->flush();
+        cursor.pending = false;
+    }
+}
+
+// Wait until every line logged so far is written
+static inline void tourLogSyncAll() {
+    tourLogRing()->syncAll();
+}
+
+#endif // TOUR_NO_LOG
+
+#endif // TOUR_LOG_H
@@ -0,0 +1,380 @@
+#ifndef TOUR_SYNC_H
+#define TOUR_SYNC_H
+
+#include <atomic>
+#include <climits>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GATE_SLOTS 4096     // Wait slots of the admission gate, must be a power of two
+#define CACHE_LINE 64
+
+// Microseconds on the monotonic clock
+static inline long tourMonotonicMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+// Clock of the tour statistics, a virtual clock replaces it when the fiber runtime runs on one
+static inline long (*tourClock)() = tourMonotonicMicros;
+
+// Sleep while *word still holds expected, at most timeout if given
+static inline void futexWait(std::atomic<unsigned>* word, unsigned expected, const struct timespec* timeout = NULL) {
+    syscall(SYS_futex, reinterpret_cast<unsigned*>(word), FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+// Wake up to count threads sleeping on word, returns the number woken
+static inline int futexWake(std::atomic<unsigned>* word, int count) {
+    return (int) syscall(SYS_futex, reinterpret_cast<unsigned*>(word), FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// Waiter that is not a sleeping thread, such as a suspended coroutine.
+// wake() runs once the wait is over, on the thread that ended it.
+struct TourWaiter {
+    void (*wake)(TourWaiter* waiter);
+    unsigned key;               // Ticket or generation waited for
+    TourWaiter* next;
+};
+
+// Test and set lock for the short critical sections around TourWaiter lists
+class SpinLock {
+public:
+    SpinLock() : locked(false) {}
+
+    void lock() {
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed)) {
+                sched_yield();
+            }
+        }
+    }
+
+    void unlock() { locked.store(false, std::memory_order_release); }
+
+private:
+    std::atomic<bool> locked;
+};
+
+// FIFO admission gate. Every arrival draws a ticket, tickets below the limit
+// may pass. Waiters sleep on the slot of their ticket, so admitting a ticket
+// only wakes the thread holding it, plus the rare waiter whose ticket is a
+// multiple of GATE_SLOTS away and goes back to sleep. TourWaiters park in
+// the bucket of their ticket instead and are woken the same way. A ticket
+// given up leaves a marker in its bucket, a TourWaiter without wake(), and
+// admitting it passes the place on to the next ticket.
+class TicketGate {
+public:
+    explicit TicketGate(unsigned initialLimit) : nextTicket(0), limit(initialLimit), waits(0), wakeups(0), parked(0) {
+        for (int i = 0; i < GATE_SLOTS; i++) {
+            turns[i].store(0, std::memory_order_relaxed);
+            buckets[i] = NULL;
+        }
+    }
+
+    // Take a ticket and wait until it is admitted
+    void enter() {
+        wait(draw());
+    }
+
+    // Sequentially consistent against admit(), either the limit check
+    // sees the new limit or admit() sees the ticket and wakes its slot
+    unsigned draw() { return nextTicket.fetch_add(1); }
+    bool admitted(unsigned ticket) const { return (int) (ticket - limit.load()) < 0; }
+
+    // Sleep until ticket is admitted
+    void wait(unsigned ticket) {
+        if (admitted(ticket)) {
+            return;
+        }
+
+        // A slot holds the round of the last ticket admitted on it
+        std::atomic<unsigned>* turn = &turns[ticket & (GATE_SLOTS - 1)];
+        unsigned round = ticket / GATE_SLOTS + 1;
+        unsigned seen = turn->load(std::memory_order_acquire);
+        if ((int) (seen - round) >= 0) {
+            return;
+        }
+        waits.fetch_add(1, std::memory_order_relaxed);
+        while ((int) (seen - round) < 0) {
+            futexWait(turn, seen);
+            seen = turn->load(std::memory_order_acquire);
+        }
+    }
+
+    // Sleep until ticket is admitted or tourClock() reached deadline, returns true if admitted
+    bool wait(unsigned ticket, long deadline) {
+        if (admitted(ticket)) {
+            return true;
+        }
+        std::atomic<unsigned>* turn = &turns[ticket & (GATE_SLOTS - 1)];
+        unsigned round = ticket / GATE_SLOTS + 1;
+        unsigned seen = turn->load(std::memory_order_acquire);
+        bool slept = false;
+        while ((int) (seen - round) < 0) {
+            long remaining = deadline - tourClock();
+            if (remaining <= 0) {
+                return false;
+            }
+            if (!slept) {
+                waits.fetch_add(1, std::memory_order_relaxed);
+                slept = true;
+            }
+            struct timespec timeout = { remaining / 1000000, (remaining % 1000000) * 1000 };
+            futexWait(turn, seen, &timeout);
+            seen = turn->load(std::memory_order_acquire);
+        }
+        return true;
+    }
+
+    // Park waiter until its ticket in waiter->key is admitted. Returns false,
+    // without parking, if it already is.
+    bool park(TourWaiter* waiter) {
+        if (!insert(waiter)) {
+            return false;
+        }
+        waits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Give up ticket before it is admitted, its place then goes to the next
+    // ticket. Returns false, giving up nothing, if it was admitted meanwhile.
+    bool giveUp(unsigned ticket) {
+        TourWaiter* marker = new TourWaiter{NULL, ticket, NULL};
+        if (insert(marker)) {
+            return true;
+        }
+        delete marker;
+        return false;
+    }
+
+    // Same for the ticket of a parked waiter, which is taken back. Returns
+    // false if admit() took it already, it is then woken.
+    bool giveUp(TourWaiter* waiter) {
+        TourWaiter* marker = new TourWaiter{NULL, waiter->key, NULL};
+        parkLock.lock();
+        for (TourWaiter** link = &buckets[waiter->key & (GATE_SLOTS - 1)]; *link != NULL; link = &(*link)->next) {
+            if (*link == waiter) {
+                marker->next = waiter->next;
+                *link = marker;
+                parkLock.unlock();
+                return true;
+            }
+        }
+        parkLock.unlock();
+        delete marker;
+        return false;
+    }
+
+    // Take back the admitted places nobody drew a ticket for yet, returns
+    // how many. They go to tickets that are drawn here and never used, so a
+    // concurrent draw() either got its place before or waits for a new one.
+    unsigned withdraw() {
+        unsigned drawn = nextTicket.load();
+        for (;;) {
+            int unclaimed = (int) (limit.load() - drawn);
+            if (unclaimed <= 0) {
+                return 0;
+            }
+            if (nextTicket.compare_exchange_weak(drawn, drawn + unclaimed)) {
+                return unclaimed;
+            }
+        }
+    }
+
+    // Admit the next count tickets in order, safe to call concurrently
+    void admit(unsigned count) {
+        // Places of tickets given up move on, in a loop rather than recursion
+        while (count > 0) {
+            unsigned first = limit.fetch_add(count);
+            unsigned drawn = nextTicket.load();
+            unsigned passed = parked.load() > 0 ? wakeParked(first, count) : 0;
+            for (unsigned ticket = first; ticket != first + count; ticket++) {
+                // Never move a slot back to an earlier round, a concurrent
+                // admit() may already have passed a later ticket on it
+                std::atomic<unsigned>* turn = &turns[ticket & (GATE_SLOTS - 1)];
+                unsigned round = ticket / GATE_SLOTS + 1;
+                unsigned seen = turn->load(std::memory_order_relaxed);
+                while ((int) (seen - round) < 0 &&
+                       !turn->compare_exchange_weak(seen, round, std::memory_order_release, std::memory_order_relaxed)) {
+                }
+                // Tickets nobody drew yet pass on the limit check without sleeping
+                if ((int) (ticket - drawn) < 0) {
+                    int woken = futexWake(turn, INT_MAX);
+                    if (woken > 0) {
+                        wakeups.fetch_add(woken, std::memory_order_relaxed);
+                    }
+                }
+            }
+            count = passed;
+        }
+    }
+
+    unsigned long waitCount() const { return waits.load(std::memory_order_relaxed); }
+    unsigned long wakeupCount() const { return wakeups.load(std::memory_order_relaxed); }
+
+private:
+    // Put waiter in the bucket of its ticket unless the ticket is admitted
+    bool insert(TourWaiter* waiter) {
+        parked.fetch_add(1);
+        parkLock.lock();
+        if (admitted(waiter->key)) {
+            parkLock.unlock();
+            parked.fetch_sub(1);
+            return false;
+        }
+        TourWaiter** bucket = &buckets[waiter->key & (GATE_SLOTS - 1)];
+        waiter->next = *bucket;
+        *bucket = waiter;
+        parkLock.unlock();
+        return true;
+    }
+
+    // Wake the parked waiters holding one of count tickets from first,
+    // returns the number of those tickets that were given up
+    unsigned wakeParked(unsigned first, unsigned count) {
+        TourWaiter* ready = NULL;
+        int found = 0;
+        unsigned passed = 0;
+        parkLock.lock();
+        for (unsigned ticket = first; ticket != first + count; ticket++) {
+            TourWaiter** link = &buckets[ticket & (GATE_SLOTS - 1)];
+            while (*link != NULL) {
+                TourWaiter* waiter = *link;
+                if (waiter->key == ticket) {
+                    *link = waiter->next;
+                    waiter->next = ready;
+                    ready = waiter;
+                    found++;
+                } else {
+                    link = &waiter->next;
+                }
+            }
+        }
+        parkLock.unlock();
+
+        if (found > 0) {
+            parked.fetch_sub(found);
+        }
+        while (ready != NULL) {
+            TourWaiter* waiter = ready;
+            ready = waiter->next;
+            if (waiter->wake == NULL) {
+                passed++;
+                delete waiter;
+            } else {
+                waiter->wake(waiter);
+            }
+        }
+        if (found > (int) passed) {
+            wakeups.fetch_add(found - passed, std::memory_order_relaxed);
+        }
+        return passed;
+    }
+
+    // Arrivals and admissions come from different threads, keep them apart
+    alignas(CACHE_LINE) std::atomic<unsigned> nextTicket;  // Next ticket to hand out
+    alignas(CACHE_LINE) std::atomic<unsigned> limit;       // Tickets below this are admitted
+    alignas(CACHE_LINE) std::atomic<unsigned long> waits;  // Arrivals that had to sleep
+    std::atomic<unsigned long> wakeups;     // Threads woken by admit()
+    alignas(CACHE_LINE) std::atomic<unsigned> turns[GATE_SLOTS];
+    alignas(CACHE_LINE) std::atomic<int> parked;           // TourWaiters in buckets
+    SpinLock parkLock;
+    TourWaiter* buckets[GATE_SLOTS];        // Parked TourWaiters by ticket slot
+};
+
+// Generation counted broadcast. Waiters wait out one generation, release()
+// moves on to the next one and wakes all of them with a single futex call,
+// plus any parked TourWaiters.
+class GenerationBroadcast {
+public:
+    GenerationBroadcast() : generation(0), wakeups(0), parkedWaiters(NULL) {}
+
+    unsigned current() const { return generation.load(std::memory_order_acquire); }
+
+    // Wait until the generation moved past gen
+    void wait(unsigned gen) {
+        unsigned seen = generation.load(std::memory_order_acquire);
+        while (seen == gen) {
+            futexWait(&generation, seen);
+            seen = generation.load(std::memory_order_acquire);
+        }
+    }
+
+    // Wait until the generation moved past gen or tourClock() reached deadline
+    void wait(unsigned gen, long deadline) {
+        unsigned seen = generation.load(std::memory_order_acquire);
+        while (seen == gen) {
+            long remaining = deadline - tourClock();
+            if (remaining <= 0) {
+                return;
+            }
+            struct timespec timeout = { remaining / 1000000, (remaining % 1000000) * 1000 };
+            futexWait(&generation, seen, &timeout);
+            seen = generation.load(std::memory_order_acquire);
+        }
+    }
+
+    // Park waiter until the generation moved past gen. Returns false,
+    // without parking, if it already has.
+    bool park(TourWaiter* waiter, unsigned gen) {
+        parkLock.lock();
+        if (generation.load() != gen) {
+            parkLock.unlock();
+            return false;
+        }
+        waiter->key = gen;
+        waiter->next = parkedWaiters;
+        parkedWaiters = waiter;
+        parkLock.unlock();
+        return true;
+    }
+
+    // Take a parked waiter back. Returns false if it is not parked, then
+    // release() has taken it and wakes it.
+    bool cancel(TourWaiter* waiter) {
+        parkLock.lock();
+        for (TourWaiter** link = &parkedWaiters; *link != NULL; link = &(*link)->next) {
+            if (*link == waiter) {
+                *link = waiter->next;
+                parkLock.unlock();
+                return true;
+            }
+        }
+        parkLock.unlock();
+        return false;
+    }
+
+    void release() {
+        generation.fetch_add(1);
+        int woken = futexWake(&generation, INT_MAX);
+
+        parkLock.lock();
+        TourWaiter* ready = parkedWaiters;
+        parkedWaiters = NULL;
+        parkLock.unlock();
+        while (ready != NULL) {
+            TourWaiter* waiter = ready;
+            ready = waiter->next;
+            waiter->wake(waiter);
+            woken++;
+        }
+
+        if (woken > 0) {
+            wakeups.fetch_add(woken, std::memory_order_relaxed);
+        }
+    }
+
+    unsigned long wakeupCount() const { return wakeups.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<unsigned> generation;
+    std::atomic<unsigned long> wakeups;     // Threads and TourWaiters woken by release()
+    SpinLock parkLock;
+    TourWaiter* parkedWaiters;
+};
+
+#endif // TOUR_SYNC_H
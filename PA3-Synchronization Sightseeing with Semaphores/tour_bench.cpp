@@ -0,0 +1,315 @@
+#include <semaphore.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "TourFiber.h"
+
+using namespace std;
+
+// Tour benchmark. Sweeps visitor count, group size and guide presence and
+// prints one row per combination: tours per second, arrival to start
+// latency (p50/p99), tours started short by a deadline and the places they
+// left empty, time spent at the admission gate and on the mutex (real
+// time, also under -V), context switches per tour, and visitors woken per
+// tour by the gate and by tourEnd. start() takes a fixed or exponentially
+// distributed time, visitors arrive in a burst, as a Poisson process or at
+// fixed gaps. Visitors are threads, or coroutines with -m fiber, where -V
+// runs on a virtual clock so long tours finish instantly. With -c the
+// group sizes 2, 4 and 8 run on the compile-time BasicTour<GroupSize, Guide>
+// instead of the runtime configured Tour. -D bounds how long a visitor waits
+// for its tour to start, at the gate and in the forming group, -P picks what
+// happens then.
+// The status lines go to /dev/null, the report to the original stdout.
+
+static long startMicros = 1000;
+static bool exponentialStart = false;
+
+// Arrival offset and start() duration of every visitor, in microseconds
+static vector<long> arrivalOffsets;
+static vector<long> startDurations;
+static long arrivalBase = 0;
+static thread_local long currentVisitor = 0;
+
+void Tour::start(){
+    usleep(startDurations[currentVisitor]);
+}
+
+FiberSleep Tour::startAsync(){
+    return FiberSleep(startDurations[currentVisitor]);
+}
+
+// Compile-time tour with the same start()
+template <int GroupSize, int Guide>
+class StaticTour : public BasicTour<GroupSize, Guide> {
+public:
+    using BasicTour<GroupSize, Guide>::BasicTour;
+
+    void start() {
+        usleep(startDurations[currentVisitor]);
+    }
+    FiberSleep startAsync() {
+        return FiberSleep(startDurations[currentVisitor]);
+    }
+};
+
+
+
+template <class T>
+static T* tour = nullptr;
+
+template <class T>
+void* visitor_thread(void* arg) {
+    T* tour = ::tour<T>;
+    currentVisitor = (long) arg;
+    long wait = arrivalBase + arrivalOffsets[currentVisitor] - tourClock();
+    if (wait > 0) {
+        usleep(wait);
+    }
+    tour->arrive();
+    tour->start();
+    tour->leave();
+    return NULL;
+}
+
+template <class T>
+FiberTask visitor_fiber(long index) {
+    T* tour = ::tour<T>;
+    co_await FiberSleep(arrivalBase + arrivalOffsets[index] - tourClock());
+    TourVisit visit;
+    visit.id = index + 1;
+    co_await tour->arriveAsync(visit);
+    currentVisitor = index;
+    co_await tour->startAsync();
+    co_await tour->leaveAsync(visit);
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Comma separated list of integers
+static vector<int> parseList(const char* text) {
+    vector<int> values;
+    string s(text);
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t comma = s.find(',', pos);
+        if (comma == string::npos) {
+            comma = s.size();
+        }
+        values.push_back(atoi(s.substr(pos, comma - pos).c_str()));
+        pos = comma + 1;
+    }
+    return values;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-n visitors,...] [-g groupSize,...] [-t tourGuidePresent,...] [-k maxTours]\n"
+                    "          [-s startMicros] [-e] [-a burst|poisson:PER_SEC|fixed:GAP_MICROS]\n"
+                    "          [-m thread|fiber] [-w workers] [-V] [-c] [-D maxWaitMicros] [-P leave|early] [-r seed]\n"
+                    "  -e  exponentially distributed start() time with mean startMicros\n"
+                    "  -V  virtual clock, fiber mode only\n"
+                    "  -c  compile-time tours for group sizes 2, 4 and 8\n"
+                    "  -D  longest wait for the tour start, at the gate and in the group, 0 for none\n"
+                    "  -P  at the deadline leave, or start the tour early with a smaller group\n", prog);
+}
+
+// Settings shared by every configuration of the sweep
+static int maxTours = 1;
+static double arrivalRate = 0;      // Poisson arrivals per second, 0 for none
+static long arrivalGap = 0;         // Fixed gap between arrivals
+static bool fibers = false;
+static bool virtualTime = false;
+static int workers = 4;
+static unsigned long seed = 1;
+static long maxWait = 0;
+static TourDeadlinePolicy deadlinePolicy = TOUR_DEADLINE_LEAVE;
+static pthread_attr_t attr;
+static FILE* out = NULL;
+
+// Run one configuration on tour type T and print its row
+template <class T>
+static void runConfig(int visitorNum, int groupSize, int tourGuidePresent, const char* kind) {
+    try {
+        tour<T> = new T(groupSize, tourGuidePresent, maxTours);
+    } catch (const std::exception& e) {
+        fprintf(out, "%9d %5d %5d %7s | Exception caught:  %s\n", visitorNum, groupSize, tourGuidePresent, kind, e.what());
+        return;
+    }
+    tour<T>->setDeadline(maxWait, deadlinePolicy);
+
+    // Same arrivals and durations for every configuration of a seed
+    mt19937_64 random(seed);
+    exponential_distribution<double> interArrival(arrivalRate > 0 ? arrivalRate / 1e6 : 1.0);
+    exponential_distribution<double> duration(1.0 / (startMicros > 0 ? startMicros : 1));
+    arrivalOffsets.assign(visitorNum, 0);
+    startDurations.assign(visitorNum, startMicros);
+    double offset = 0;
+    for (int i = 0; i < visitorNum; i++) {
+        if (arrivalRate > 0) {
+            offset += interArrival(random);
+        } else {
+            offset = (double) i * arrivalGap;
+        }
+        arrivalOffsets[i] = (long) offset;
+        if (exponentialStart) {
+            startDurations[i] = (long) duration(random);
+        }
+    }
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    double wallBegin = now_seconds();
+    long clockBegin = 0;
+    long clockEnd = 0;
+
+    if (fibers) {
+        FiberRuntime runtime(workers, virtualTime);
+        clockBegin = arrivalBase = tourClock();
+        for (int i = 0; i < visitorNum; i++) {
+            runtime.spawn(visitor_fiber<T>(i));
+        }
+        runtime.run();
+        clockEnd = tourClock();
+    } else {
+        clockBegin = arrivalBase = tourClock();
+        vector<pthread_t> allThreads;
+        for (long i = 0; i < visitorNum; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, &attr, visitor_thread<T>, (void*) i) != 0) {
+                perror("pthread_create");
+                break;
+            }
+            allThreads.push_back(thread);
+        }
+        for (size_t i = 0; i < allThreads.size(); i++) {
+            pthread_join(allThreads[i], NULL);
+        }
+        clockEnd = tourClock();
+    }
+
+    double wallElapsed = now_seconds() - wallBegin;
+    getrusage(RUSAGE_SELF, &after);
+
+    TourStats s = tour<T>->stats();
+    double elapsed = (clockEnd - clockBegin) / 1e6;
+    double tours = s.tours > 0 ? (double) s.tours : 1.0;
+    long switches = after.ru_nvcsw - before.ru_nvcsw + after.ru_nivcsw - before.ru_nivcsw;
+    fprintf(out, "%9d %5d %5d %7s | %7lu %10.1f | %7lu %7lu %7lu | %10.3f %10.3f | %12.3f %12ld | %9.2f %9.2f %9.2f",
+            visitorNum, groupSize, tourGuidePresent, kind, s.tours, elapsed > 0 ? s.tours / elapsed : 0.0,
+            s.partialTours, s.emptyPlaces, s.earlyLeaves, s.waitPercentile(0.50) / 1e3, s.waitPercentile(0.99) / 1e3,
+            visitorNum > 0 ? s.gateWaitMicros / 1e3 / visitorNum : 0.0,
+            s.mutexWaitMicros, switches / tours, s.gateWakeups / tours, s.endWakeups / tours);
+    if (virtualTime) {
+        fprintf(out, "  (%.1f s virtual in %.3f s)", elapsed, wallElapsed);
+    } else {
+        fprintf(out, "  (%.3f s)", wallElapsed);
+    }
+    fprintf(out, "\n");
+    fflush(out);
+    delete tour<T>;
+    tour<T> = nullptr;
+}
+
+template <int GroupSize>
+static void runStatic(int visitorNum, int tourGuidePresent) {
+    if (tourGuidePresent == 1) {
+        runConfig<StaticTour<GroupSize, 1> >(visitorNum, GroupSize, tourGuidePresent, "static");
+    } else {
+        runConfig<StaticTour<GroupSize, 0> >(visitorNum, GroupSize, tourGuidePresent, "static");
+    }
+}
+
+int main(int argc, char *argv[]){
+    vector<int> visitorNums(1, 2000);
+    vector<int> groupSizes(1, 4);
+    vector<int> guides(1, 1);
+    string arrival = "burst";
+    bool compileTime = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:t:k:s:ea:m:w:VcD:P:r:")) != -1) {
+        switch (opt) {
+        case 'n': visitorNums = parseList(optarg); break;
+        case 'g': groupSizes = parseList(optarg); break;
+        case 't': guides = parseList(optarg); break;
+        case 'k': maxTours = atoi(optarg); break;
+        case 's': startMicros = atol(optarg); break;
+        case 'e': exponentialStart = true; break;
+        case 'a': arrival = optarg; break;
+        case 'm': fibers = string(optarg) == "fiber"; break;
+        case 'w': workers = atoi(optarg); break;
+        case 'V': virtualTime = true; break;
+        case 'c': compileTime = true; break;
+        case 'D': maxWait = atol(optarg); break;
+        case 'P': deadlinePolicy = string(optarg) == "early" ? TOUR_DEADLINE_START_EARLY : TOUR_DEADLINE_LEAVE; break;
+        case 'r': seed = strtoul(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (virtualTime && !fibers) {
+        fprintf(stderr, "The virtual clock needs -m fiber, threads really sleep\n");
+        return 1;
+    }
+    if (arrival.compare(0, 8, "poisson:") == 0) {
+        arrivalRate = atof(arrival.c_str() + 8);
+    } else if (arrival.compare(0, 6, "fixed:") == 0) {
+        arrivalGap = atol(arrival.c_str() + 6);
+    } else if (arrival != "burst") {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Keep the report on the real stdout
+    fflush(stdout);
+    int report = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    out = fdopen(report, "w");
+
+    fprintf(out, "%s visitors, %d tour slots, start %ld us%s, arrivals %s, wait %ld us then %s%s\n",
+            fibers ? "Fiber" : "Thread", maxTours, startMicros, exponentialStart ? " (exponential)" : "",
+            arrival.c_str(), maxWait, deadlinePolicy == TOUR_DEADLINE_START_EARLY ? "start early" : "leave",
+            virtualTime ? ", virtual clock" : "");
+    fprintf(out, "%9s %5s %5s %7s | %7s %10s | %7s %7s %7s | %10s %10s | %12s %12s | %9s %9s %9s\n",
+            "visitors", "group", "guide", "tour", "tours", "tours/s", "partial", "empty", "left", "p50 ms", "p99 ms",
+            "gate ms/vis", "mutex us", "ctx/tour", "gate/tour", "end/tour");
+
+    // Small stacks so thousands of visitors fit
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+
+    for (size_t ni = 0; ni < visitorNums.size(); ni++) {
+        for (size_t gi = 0; gi < groupSizes.size(); gi++) {
+            for (size_t ti = 0; ti < guides.size(); ti++) {
+                int visitorNum = visitorNums[ni];
+                int groupSize = groupSizes[gi];
+                int tourGuidePresent = guides[ti];
+
+                runConfig<Tour>(visitorNum, groupSize, tourGuidePresent, "runtime");
+                if (compileTime && (tourGuidePresent == 0 || tourGuidePresent == 1)) {
+                    switch (groupSize) {
+                    case 2: runStatic<2>(visitorNum, tourGuidePresent); break;
+                    case 4: runStatic<4>(visitorNum, tourGuidePresent); break;
+                    case 8: runStatic<8>(visitorNum, tourGuidePresent); break;
+                    }
+                }
+            }
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    fflush(stdout);
+    fclose(out);
+    return 0;
+}
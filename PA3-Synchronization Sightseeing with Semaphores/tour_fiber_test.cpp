@@ -0,0 +1,112 @@
+#include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "TourFiber.h"
+
+using namespace std;
+
+// Like tour_test, but every visitor is a coroutine on a few worker threads,
+// so runs with 100k visitors and more are possible. The thread ID column
+// shows the visitor number. With -q the status lines are discarded and only
+// the report is printed.
+
+static long startMillis = 3000;
+
+FiberSleep Tour::startAsync(){
+    return FiberSleep(startMillis * 1000);
+}
+
+
+
+Tour* tour = nullptr;
+
+FiberTask visitor_fiber(unsigned long id) {
+    TourVisit visit;
+    visit.id = id;
+    co_await tour->arriveAsync(visit);
+    co_await tour->startAsync();
+    co_await tour->leaveAsync(visit);
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-n visitors] [-g groupSize] [-t tourGuidePresent] [-k maxTours] [-w workers] [-s startMillis] [-q]\n", prog);
+}
+
+int main(int argc, char *argv[]){
+    long visitorNum = 100000;
+    int groupSize = 4;
+    int tourGuidePresent = 1;
+    int maxTours = 1;
+    int workers = 4;
+    bool quiet = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:t:k:w:s:q")) != -1) {
+        switch (opt) {
+        case 'n': visitorNum = atol(optarg); break;
+        case 'g': groupSize = atoi(optarg); break;
+        case 't': tourGuidePresent = atoi(optarg); break;
+        case 'k': maxTours = atoi(optarg); break;
+        case 'w': workers = atoi(optarg); break;
+        case 's': startMillis = atol(optarg); break;
+        case 'q': quiet = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    try {
+        tour = new Tour(groupSize, tourGuidePresent, maxTours);
+    } catch (const std::exception& e) {
+        printf("Exception caught:  %s\n", e.what());
+        return 0;
+    }
+
+    int report = -1;
+    if (quiet) {
+        fflush(stdout);
+        report = dup(STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    }
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    double begin = now_seconds();
+
+    FiberRuntime runtime(workers);
+    for (long i = 1; i <= visitorNum; i++) {
+        runtime.spawn(visitor_fiber(i));
+    }
+    size_t spawnedFrames = FiberTask::promise_type::frameBytes.load();
+    runtime.run();
+
+    double elapsed = now_seconds() - begin;
+    getrusage(RUSAGE_SELF, &after);
+
+    if (quiet) {
+        fflush(stdout);
+        dup2(report, STDOUT_FILENO);
+        close(report);
+    }
+
+    TourStats s = tour->stats();
+    printf("The Main terminates.\n");
+    printf("Visitors: %ld on %d workers, group size %d, guide %d, %d tour slots, start %ld ms\n",
+           visitorNum, workers, groupSize, tourGuidePresent, maxTours, startMillis);
+    printf("Tours: %lu in %.3f s, at most %d at once\n", s.tours, elapsed, s.peakTours);
+    printf("Memory per visitor: %.0f bytes of coroutine frame, %.0f bytes of peak RSS growth\n",
+           visitorNum > 0 ? (double) spawnedFrames / visitorNum : 0.0,
+           visitorNum > 0 ? (after.ru_maxrss - before.ru_maxrss) * 1024.0 / visitorNum : 0.0);
+    return 0;
+}